@@ -3,8 +3,14 @@ FILE_MODE_CR = 2L
 
 TYPE_DOUBLE = 1L
 TYPE_FLOAT = 2L
+TYPE_FLOAT16 = 3L
+TYPE_BFLOAT16 = 4L
+TYPE_INT8 = 5L
 
-TYPES_STR = c("double", "float")
+STORAGE_FULL = 1L
+STORAGE_SYM = 2L
+
+TYPES_STR = c("double", "float", "float16", "bfloat16", "int8")
 TYPES_INT = 1:length(TYPES_STR)
 names(TYPES_INT) = TYPES_STR
 
@@ -22,3 +28,135 @@ type_robj2int = function(robj)
 }
 
 type_robj2str = function(robj) type_int2str(type_robj2int(robj))
+
+STORAGES_STR = c("full", "symmetric")
+storage_int2str = function(storage) STORAGES_STR[storage]
+
+CHUNKINGS_STR = c("rows", "cols", "tiles", "contiguous")
+
+FILTERS_STR = c("shuffle", "deflate", "nbit", "scaleoffset")
+
+EW_SCALE = 1L
+EW_ADD = 2L
+EW_POW = 3L
+EW_ABS = 4L
+EW_CLAMP = 5L
+EW_LOG = 6L
+EW_OPS_STR = c("scale", "add", "pow", "abs", "clamp", "log")
+
+REDUCE_ROWS = 1L
+REDUCE_COLS = 2L
+REDUCE_TRACE = 4L
+REDUCTIONS_STR = c("rowSums", "colSums", "rowMeans", "colMeans", "rowNorms", "colNorms", "norm", "min", "max", "trace")
+
+filters_str = function(filters)
+{
+  args = ifelse(filters > 0, paste0("(", filters, ")"), "")
+  paste0(names(filters), args, collapse=", ")
+}
+
+
+
+is_hdfmat = function(x) inherits(x, "cpumat") && inherits(x, "R6")
+
+# private fields of another hdfmat object
+hdfmat_private = function(x)
+{
+  p = x$.__enclos_env__$private
+  if (is.null(p$fp))
+    stop("input hdfmat is closed")
+  
+  p
+}
+
+
+
+check_mem = function(mem)
+{
+  if (!is.numeric(mem) || length(mem) != 1 || is.na(mem) || mem <= 0)
+    stop("'mem' must be a positive number (MiB)")
+  
+  as.double(mem)
+}
+
+
+
+check_passes = function(passes)
+{
+  if (!is.numeric(passes) || length(passes) != 1 || is.na(passes) || passes < 2)
+    stop("'passes' must be an integer >= 2")
+  
+  as.integer(passes)
+}
+
+
+
+check_scalar = function(v, arg)
+{
+  if (!is.numeric(v) || length(v) != 1 || is.na(v))
+    stop(paste0("'", arg, "' must be a single number"))
+  
+  as.double(v)
+}
+
+
+
+# Seed of the native counter-based generator. Without one, it is drawn from
+# R's generator, so set.seed() still makes the results reproducible.
+check_seed = function(seed)
+{
+  if (is.null(seed))
+    seed = sample.int(.Machine$integer.max, 1L)
+  else if (!is.numeric(seed) || length(seed) != 1 || is.na(seed) || seed < 0 || seed >= 2^53)
+    stop("'seed' must be a non-negative number less than 2^53")
+  
+  as.double(floor(seed))
+}
+
+
+
+# The filter pipeline as a named integer vector of filter arguments in the
+# order HDF5 applies them: bit reduction, then byte shuffle, then deflate.
+check_filters = function(filters, compression, digits, precision)
+{
+  if (is.null(filters))
+    filters = character(0)
+  else if (!is.character(filters))
+    stop("'filters' must be a character vector")
+  
+  filters = unique(tolower(filters))
+  bad = setdiff(filters, FILTERS_STR)
+  if (length(bad) > 0)
+    stop(paste0("unknown filter(s): ", paste(bad, collapse=", ")))
+  
+  if (compression > 0)
+    filters = union(filters, "deflate")
+  
+  if (all(c("nbit", "scaleoffset") %in% filters))
+    stop("only one of \"nbit\" and \"scaleoffset\" can be used")
+  
+  order = c("nbit", "scaleoffset", "shuffle", "deflate")
+  filters = order[order %in% filters]
+  
+  args = integer(length(filters))
+  names(args) = filters
+  
+  if ("deflate" %in% filters)
+    args["deflate"] = max(compression, 1L)
+  
+  if ("scaleoffset" %in% filters)
+  {
+    if (!is.numeric(digits) || length(digits) != 1 || is.na(digits) || digits < 0)
+      stop("'digits' must be a non-negative integer")
+    args["scaleoffset"] = as.integer(digits)
+  }
+  
+  if ("nbit" %in% filters)
+  {
+    if (!is.numeric(precision) || length(precision) != 1 || is.na(precision) || precision < 1)
+      stop("'precision' must be a positive integer")
+    args["nbit"] = as.integer(precision)
+  }
+  
+  args
+}
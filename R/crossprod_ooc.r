@@ -3,7 +3,8 @@
 #' Out-of-core crossproduct. Useful when the number of columns is very large.
 #' 
 #' @param x
-#' The input matrix. Should be in double precision.
+#' The input matrix. Should be in double precision. Can also be an hdfmat,
+#' in which case it is read in blocks of rows and the result has its type.
 #' @param file
 #' Name of the file to use for the out-of-core storage.
 #' @param name
@@ -11,25 +12,36 @@
 #' @param compression The compression level, an integer from 0 (no compression)
 #' to 9 (highest compression). Run-time performance degrades with increased
 #' compression levels.
+#' @param storage Either "full" or "symmetric". See \code{\link{hdfmat}}.
+#' @param mem Memory budget (in MiB) for the band of result rows computed and
+#' written at a time.
 #' 
 #' @return Returns an hdfmat object.
 #' 
 #' @rdname crossprod_ooc
 #' @export
-crossprod_ooc = function(x, file, name="crossprod", compression=0L)
+crossprod_ooc = function(x, file, name="crossprod", compression=0L, storage="full", mem=64)
 {
-  if (!is.matrix(x) && !float::is.float(x))
-    x = as.matrix(x)
+  if (is_hdfmat(x))
+  {
+    type = type_int2str(hdfmat_private(x)$type)
+    n = as.double(x$dim()[2])
+  }
+  else
+  {
+    if (!is.matrix(x) && !float::is.float(x))
+      x = as.matrix(x)
+    
+    if (is.integer(x) || float::is.float(x))
+      type = "float"
+    else #if (!is.double(x))
+      type = "double"
+    
+    n = as.double(ncol(x))
+  }
   
-  if (is.integer(x) || float::is.float(x))
-    type = "float"
-  else #if (!is.double(x))
-    type = "double"
-  
-  n = as.double(ncol(x))
-  
-  h = hdfmat(file, name, n, n, type, compression=compression)
-  h$fill_crossprod(x)
+  h = hdfmat(file, name, n, n, type, compression=compression, storage=storage)
+  h$fill_crossprod(x, mem=mem)
   
   h
 }
@@ -38,20 +50,28 @@ crossprod_ooc = function(x, file, name="crossprod", compression=0L)
 
 #' @rdname crossprod_ooc
 #' @export
-tcrossprod_ooc = function(x, file, name="tcrossprod", compression=0L)
+tcrossprod_ooc = function(x, file, name="tcrossprod", compression=0L, storage="full", mem=64)
 {
-  if (!is.matrix(x) && !float::is.float(x))
-    x = as.matrix(x)
-  
-  if (is.integer(x) || float::is.float(x))
-    type = "float"
-  else #if (!is.double(x))
-    type = "double"
-  
-  m = as.double(nrow(x))
+  if (is_hdfmat(x))
+  {
+    type = type_int2str(hdfmat_private(x)$type)
+    m = as.double(x$dim()[1])
+  }
+  else
+  {
+    if (!is.matrix(x) && !float::is.float(x))
+      x = as.matrix(x)
+    
+    if (is.integer(x) || float::is.float(x))
+      type = "float"
+    else #if (!is.double(x))
+      type = "double"
+    
+    m = as.double(nrow(x))
+  }
   
-  h = hdfmat(file, name, m, m, type, compression=compression)
-  h$fill_tcrossprod(x)
+  h = hdfmat(file, name, m, m, type, compression=compression, storage=storage)
+  h$fill_tcrossprod(x, mem=mem)
   
   h
 }
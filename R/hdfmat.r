@@ -5,22 +5,35 @@
 #' @details
 #' Data is held in an external pointer.
 #' 
+#' @useDynLib hdfmat R_hdfmat_cache_info
+#' @useDynLib hdfmat R_hdfmat_cache_invalidate
+#' @useDynLib hdfmat R_hdfmat_cache_new
 #' @useDynLib hdfmat R_hdfmat_cp
+#' @useDynLib hdfmat R_hdfmat_cp_ooc
 #' @useDynLib hdfmat R_hdfmat_eigen_sym
+#' @useDynLib hdfmat R_hdfmat_ew
 #' @useDynLib hdfmat R_hdfmat_fill
-#' @useDynLib hdfmat R_hdfmat_fill_diag
+#' @useDynLib hdfmat R_hdfmat_fill_band
+#' @useDynLib hdfmat R_hdfmat_fill_identity
 #' @useDynLib hdfmat R_hdfmat_fill_linspace
 #' @useDynLib hdfmat R_hdfmat_fill_rnorm
 #' @useDynLib hdfmat R_hdfmat_fill_runif
 #' @useDynLib hdfmat R_hdfmat_fill_val
 #' @useDynLib hdfmat R_hdfmat_finalize
+#' @useDynLib hdfmat R_hdfmat_gemm_ooc
 #' @useDynLib hdfmat R_hdfmat_inherit
 #' @useDynLib hdfmat R_hdfmat_init
+#' @useDynLib hdfmat R_hdfmat_matmult
+#' @useDynLib hdfmat R_hdfmat_matmult_ooc
 #' @useDynLib hdfmat R_hdfmat_open
 #' @useDynLib hdfmat R_hdfmat_read
-#' @useDynLib hdfmat R_hdfmat_scale
+#' @useDynLib hdfmat R_hdfmat_reduce
+#' @useDynLib hdfmat R_hdfmat_reigen_sym
+#' @useDynLib hdfmat R_hdfmat_rsvd
+#' @useDynLib hdfmat R_hdfmat_stats
 #' @useDynLib hdfmat R_hdfmat_svd
 #' @useDynLib hdfmat R_hdfmat_tcp
+#' @useDynLib hdfmat R_hdfmat_tcp_ooc
 #' 
 #' @rdname hdfmat-class
 #' @name hdfmat-class
@@ -33,26 +46,35 @@ hdfmatR6 = R6::R6Class("cpumat",
     #' @param file File to store data in.
     #' @param name Dataset name on disk.
     #' @param nrows,ncols The dimension of the matrix.
-    #' @param type Storage type for the matrix. Should be one of 'int', 'float',
-    #' or 'double'.
+    #' @param type Storage type for the matrix. Should be one of 'double',
+    #' 'float', or one of the compact types 'float16', 'bfloat16', and 'int8'.
+    #' Compact matrices are read as float and computed on in float; 'int8'
+    #' stores a float scale per row (in the dataset \code{<name>_scale}), can
+    #' not use symmetric storage, and can not hold NaN or infinite values.
     #' @param compression The compression level, an integer from 0 (no compression)
     #' to 9 (highest compression). Run-time performance degrades with increased
     #' compression levels.
-    initialize = function(open, file, name, nrows, ncols, type, compression)
+    #' @param storage Either "full" or "symmetric". Symmetric storage only
+    #' keeps the tiles on and above the diagonal.
+    #' @param chunking One of "auto", "rows", "cols", "tiles", or
+    #' "contiguous". See \code{\link{hdfmat}}.
+    #' @param filters,digits,precision The filter pipeline and its
+    #' parameters. See \code{\link{hdfmat}}.
+    initialize = function(open, file, name, nrows, ncols, type, compression, storage, chunking, filters, digits, precision)
     {
       file = normalizePath(file, winslash="/", mustWork=FALSE)
       
       if (isTRUE(open))
         private$inherit(file=file, name=name)
       else
-        private$create(file=file, name=name, nrows=nrows, ncols=ncols, type=type, compression=compression)
+        private$create(file=file, name=name, nrows=nrows, ncols=ncols, type=type, compression=compression, storage=storage, chunking=chunking, filters=filters, digits=digits, precision=precision)
       
       invisible(self)
     },
     
     
     #' @details
-    #' Closes the file.
+    #' Closes the file, after applying any pending element-wise ops.
     close = function()
     {
       private$finalize()
@@ -70,6 +92,10 @@ hdfmatR6 = R6::R6Class("cpumat",
           "  * Location: ", private$file, "\n",
           "  * Dimension: ", private$nrows, "x", private$ncols, "\n",
           "  * Type: ", type_int2str(private$type), "\n",
+          if (private$storage == STORAGE_SYM) "  * Storage: symmetric\n",
+          "  * Chunking: ", private$chunking, "\n",
+          if (length(private$filters) > 0) paste0("  * Filters: ", filters_str(private$filters), "\n"),
+          if (length(private$ops) > 0) paste0("  * Pending: ", paste(EW_OPS_STR[private$ops], collapse=", "), "\n"),
           "\n"))
     },
     
@@ -107,29 +133,20 @@ hdfmatR6 = R6::R6Class("cpumat",
         stop("x and given row_offset incompatible with hdfmat")
       
       row_offset = floor(as.double(row_offset))
-      
-      if (!asis)
-        x = t(x)
+      private$flush(overwrite=(row_offset == 0 && nrow(x) == private$nrows))
+      if (private$storage == STORAGE_SYM)
+        private$invalidate()
       else
-        dim(x) = rev(dim(x))
+        private$invalidate(row_offset, row_offset + nrow(x) - 1)
       
-      if (private$type == TYPE_DOUBLE)
-      {
-        if (float::is.float(x))
-          x = float::dbl(x)
-        else if (typeof(x) != "double")
-          storage.mode(x) = "double"
-      }
-      else # if (private$type == TYPE_FLOAT)
-      {
-        if (!float::is.float(x))
-          x = float::fl(x)@Data
-        else
-          x = x@Data
-      }
+      # transposed and converted to the storage type natively, a panel at a
+      # time, so x is never copied in full
+      if (float::is.float(x))
+        x = x@Data
+      else if (typeof(x) != "double")
+        storage.mode(x) = "double"
       
-      dim(x) = rev(dim(x))
-      .Call(R_hdfmat_fill, private$ds, x, row_offset, private$type)
+      .Call(R_hdfmat_fill, private$ds, x, row_offset, private$type, private$storage, !asis)
       invisible(self)
     },
     
@@ -168,14 +185,85 @@ hdfmatR6 = R6::R6Class("cpumat",
       col_start = as.double(col_start) - 1.0
       col_stop = as.double(col_stop) - 1.0
       
-      ret = .Call(R_hdfmat_read, row_start, row_stop, col_start, col_stop, private$ds, private$type, asis)
-      if (private$type == TYPE_FLOAT)
+      private$flush()
+      ret = .Call(R_hdfmat_read, row_start, row_stop, col_start, col_stop, private$ds, private$type, asis, private$storage, private$rcache)
+      if (private$type != TYPE_DOUBLE)
         ret = float::float32(ret)
       
-      if (!asis)
-        t(ret)
+      ret
+    },
+    
+    
+    #' @details
+    #' Enable, resize, or disable the row cache of \code{read()}. The cache
+    #' keeps recently read blocks of full rows, decoded, in an LRU list, so
+    #' repeated reads of nearby rows skip HDF5 entirely. Every method that
+    #' writes to the matrix drops the affected blocks.
+    #' @param mem Cache size in MiB; 0 disables the cache. Resizing empties it.
+    cache = function(mem=64)
+    {
+      if (!is.numeric(mem) || length(mem) != 1 || is.na(mem) || mem < 0)
+        stop("'mem' must be a non-negative number (MiB)")
+      
+      if (mem == 0)
+        private$rcache = NULL
       else
-        ret
+        private$rcache = .Call(R_hdfmat_cache_new, private$nrows, private$ncols, private$ds, private$type, as.double(mem))
+      
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Row cache counters.
+    #' @return \code{NULL} if the cache is disabled, otherwise a list with
+    #' the number of hits and misses (in blocks), the bytes in use, the limit
+    #' in bytes, and the rows per block.
+    cache_info = function()
+    {
+      if (is.null(private$rcache))
+        return(NULL)
+      
+      info = .Call(R_hdfmat_cache_info, private$rcache)
+      list(hits=info[1], misses=info[2], bytes=info[3], limit=info[4], block_rows=info[5])
+    },
+    
+    
+    #' @details
+    #' I/O and timing counters of the native calls made on this matrix since
+    #' it was created or opened, or since the last reset. Times are in
+    #' seconds: \code{io} is spent in HDF5 reads and writes (including
+    #' decompression), on the R thread or on the background stream thread;
+    #' \code{blocked} is the part of \code{wall} spent waiting for I/O;
+    #' \code{convert} is spent transposing and converting between R and file
+    #' layouts; \code{compute} is the rest of \code{wall}. \code{maps} counts
+    #' the calls that read the file through a memory map, and
+    #' \code{bytes_mapped} the bytes they used; those are not HDF5 reads. If
+    #' the row cache is on, its hit and miss counts from \code{cache_info()}
+    #' are included; they are not reset here.
+    #' HDF5 does not report hit rates of its own chunk cache.
+    #' @param reset Zero the counters after returning them?
+    stats = function(reset=FALSE)
+    {
+      v = .Call(R_hdfmat_stats, private$ds, isTRUE(reset))
+      ret = list(
+        calls = v[1],
+        reads = v[2],
+        writes = v[3],
+        bytes_read = v[4],
+        bytes_written = v[5],
+        maps = v[6],
+        bytes_mapped = v[7],
+        time = c(wall=v[8], io=v[9], blocked=v[10], convert=v[11], compute=max(0, v[8] - v[10] - v[11]))
+      )
+      
+      if (!is.null(private$rcache))
+      {
+        info = .Call(R_hdfmat_cache_info, private$rcache)
+        ret$cache = c(hits=info[1], misses=info[2], hit_rate=if (info[1] + info[2] > 0) info[1]/(info[1] + info[2]) else NA_real_)
+      }
+      
+      ret
     },
     
     
@@ -183,10 +271,99 @@ hdfmatR6 = R6::R6Class("cpumat",
     #' Scale (multiply) all values of an hdfmat-stored matrix by the input
     #' scalar.
     #' @param v Scalar. Fundamental type can be double, float, or int.
-    scale = function(v)
+    #' @param lazy If \code{TRUE}, the op is only recorded; see
+    #' \code{compute()}. Otherwise it is applied right away, together with
+    #' any ops recorded before it.
+    scale = function(v, lazy=FALSE)
     {
-      v = as.double(v)
-      .Call(R_hdfmat_scale, private$nrows, private$ncols, private$ds, v, private$type)
+      private$record(EW_SCALE, check_scalar(v, "v"))
+      if (!isTRUE(lazy))
+        self$compute()
+      
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Record adding a scalar to all values. Like the other element-wise ops
+    #' below, it is applied by \code{compute()}, or by the next method that
+    #' reads or writes the matrix.
+    #' @param v Scalar.
+    add = function(v)
+    {
+      private$record(EW_ADD, check_scalar(v, "v"))
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Record raising all values to a power.
+    #' @param p Scalar exponent.
+    pow = function(p)
+    {
+      private$record(EW_POW, check_scalar(p, "p"))
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Record taking the absolute value of all values.
+    abs = function()
+    {
+      private$record(EW_ABS)
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Record clamping all values to the interval \code{[min, max]}.
+    #' @param min,max Bounds of the interval.
+    clamp = function(min=-Inf, max=Inf)
+    {
+      min = check_scalar(min, "min")
+      max = check_scalar(max, "max")
+      if (min > max)
+        stop("need min <= max")
+      
+      private$record(EW_CLAMP, min, max)
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Record taking the logarithm of all values.
+    #' @param base Base of the logarithm.
+    log = function(base=exp(1))
+    {
+      base = check_scalar(base, "base")
+      if (base <= 0 || base == 1)
+        stop("'base' must be positive and not 1")
+      
+      private$record(EW_LOG, 1/log(base))
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Apply the recorded element-wise ops, in the order they were recorded, in
+    #' a single read/write pass over the matrix. For example
+    #' \code{h$scale(2, lazy=TRUE)$add(1)$clamp(0, 10)$compute()} reads and
+    #' writes the data once instead of three times. Every other method that
+    #' reads the matrix, or writes part of it, calls this first; methods that
+    #' overwrite the whole matrix drop the pending ops instead.
+    compute = function()
+    {
+      if (length(private$ops) > 0)
+      {
+        private$invalidate()
+        ops = private$ops
+        args = private$op_args
+        private$ops = integer(0)
+        private$op_args = numeric(0)
+        
+        .Call(R_hdfmat_ew, private$nrows, private$ncols, private$ds, ops, args, private$type, private$storage)
+      }
+      
       invisible(self)
     },
     
@@ -197,7 +374,9 @@ hdfmatR6 = R6::R6Class("cpumat",
     fill_val = function(v)
     {
       v = as.double(v)
-      .Call(R_hdfmat_fill_val, private$nrows, private$ncols, private$ds, v, private$type)
+      private$flush(overwrite=TRUE)
+      private$invalidate()
+      .Call(R_hdfmat_fill_val, private$nrows, private$ncols, private$ds, v, private$type, private$storage)
       invisible(self)
     },
     
@@ -207,6 +386,10 @@ hdfmatR6 = R6::R6Class("cpumat",
     #' @param start,stop Beginning/end of the linear spacing.
     fill_linspace = function(start, stop)
     {
+      private$check_full("fill_linspace")
+      private$flush(overwrite=TRUE)
+      private$invalidate()
+      
       if (start == stop)
         self$fill_val(start)
       else
@@ -223,18 +406,29 @@ hdfmatR6 = R6::R6Class("cpumat",
     #' @details
     #' Fill the matrix with random uniform values.
     #' @param min,max Minimum/maximum values for the generator.
-    fill_runif = function(min=0, max=1)
+    #' @param seed Seed for the generator. Element \code{(i, j)} is a function
+    #' of the seed and its position only, so the same seed gives the same
+    #' matrix regardless of the number of threads. If \code{NULL}, a seed is
+    #' drawn from R's generator (see \code{set.seed()}).
+    fill_runif = function(min=0, max=1, seed=NULL)
     {
+      private$check_full("fill_runif")
+      if (min > max)
+        stop("need min <= max")
+      else if (min < max)
+        seed = check_seed(seed)
+      
+      private$flush(overwrite=TRUE)
+      private$invalidate()
+      
       if (min == max)
         self$fill_val(min)
-      else if (min < max)
+      else
       {
         min = as.double(min)
         max = as.double(max)
-        .Call(R_hdfmat_fill_runif, private$nrows, private$ncols, private$ds, min, max, private$type)
+        .Call(R_hdfmat_fill_runif, private$nrows, private$ncols, private$ds, min, max, seed, private$type)
       }
-      else
-        stop("need min <= max")
       
       invisible(self)
     },
@@ -243,18 +437,26 @@ hdfmatR6 = R6::R6Class("cpumat",
     #' @details
     #' Fill the matrix with random normal values.
     #' @param mean,sd Mean/standard deviation values for the generator.
-    fill_rnorm = function(mean=0, sd=1)
+    #' @param seed Seed for the generator; see \code{fill_runif()}.
+    fill_rnorm = function(mean=0, sd=1, seed=NULL)
     {
+      private$check_full("fill_rnorm")
+      if (sd < 0)
+        stop("need sd >= 0")
+      else if (sd > 0)
+        seed = check_seed(seed)
+      
+      private$flush(overwrite=TRUE)
+      private$invalidate()
+      
       if (sd == 0)
         self$fill_val(mean)
-      else if (sd > 0)
+      else
       {
         mean = as.double(mean)
         sd = as.double(sd)
-        .Call(R_hdfmat_fill_rnorm, private$nrows, private$ncols, private$ds, mean, sd, private$type)
+        .Call(R_hdfmat_fill_rnorm, private$nrows, private$ncols, private$ds, mean, sd, seed, private$type)
       }
-      else
-        stop("need sd >= 0")
       
       invisible(self)
     },
@@ -266,8 +468,62 @@ hdfmatR6 = R6::R6Class("cpumat",
     #' @param v A vector. Fundamental type can be double, float, or int.
     fill_diag = function(v)
     {
-      v = as.double(v)
-      .Call(R_hdfmat_fill_diag, private$nrows, private$ncols, private$ds, v, private$type)
+      private$set_band(v, 0, 0)
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Set the elements of a band around the diagonal, those in row \code{i}
+    #' and column \code{j} with \code{-lower <= j - i <= upper}, to \code{v}.
+    #' Elements outside the band are left alone. Like the other structured
+    #' fills, this works a chunk at a time and touches only the chunks the
+    #' band runs through.
+    #' @param v A number.
+    #' @param lower,upper The number of sub- and super-diagonals. Must be
+    #' equal for symmetric storage.
+    fill_band = function(v, lower=0, upper=0)
+    {
+      v = check_scalar(v, "v")
+      if (!is.numeric(lower) || !is.numeric(upper) || length(lower) != 1 || length(upper) != 1 || is.na(lower) || is.na(upper) || lower < 0 || upper < 0)
+        stop("'lower' and 'upper' must be non-negative numbers")
+      if (private$storage == STORAGE_SYM && lower != upper)
+        stop("symmetric storage requires lower == upper")
+      
+      private$set_band(v, -floor(lower), floor(upper))
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Set the upper or lower triangle to \code{v}, leaving the other one
+    #' alone. Not available for symmetric storage.
+    #' @param v A number.
+    #' @param upper Set the upper triangle (otherwise the lower one)?
+    #' @param diag Include the diagonal?
+    fill_tri = function(v, upper=TRUE, diag=TRUE)
+    {
+      v = check_scalar(v, "v")
+      private$check_full("fill_tri")
+      
+      off = if (isTRUE(diag)) 0 else 1
+      if (isTRUE(upper))
+        private$set_band(v, off, Inf)
+      else
+        private$set_band(v, -Inf, -off)
+      
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Fill with the identity matrix (ones on the diagonal and zeros
+    #' elsewhere) in a single write-only pass.
+    fill_identity = function()
+    {
+      private$flush(overwrite=TRUE)
+      private$invalidate()
+      .Call(R_hdfmat_fill_identity, private$nrows, private$ncols, private$ds, private$type, private$storage)
       invisible(self)
     },
     
@@ -276,12 +532,38 @@ hdfmatR6 = R6::R6Class("cpumat",
     #' Calculate the crossproduct of an input matrix with result stored in an
     #' hdfmat. Useful when the number of columns of the input is very large.
     #' @param x Input matrix. Fundamental type can be double, float, or int.
-    fill_crossprod = function(x)
+    #' Can also be an hdfmat other than this one, which is streamed from disk
+    #' in blocks of rows.
+    #' @param mem Memory budget (in MiB) for the band of result rows computed
+    #' and written at a time. With an hdfmat input, half of it goes to the
+    #' result band and half to the rows of the input read at a time.
+    fill_crossprod = function(x, mem=64)
     {
-      n = ncol(x)
+      if (identical(x, self))
+        stop("'x' cannot be the hdfmat being filled")
+      mem = check_mem(mem)
+      
+      if (is_hdfmat(x))
+      {
+        p = hdfmat_private(x)
+        n = p$ncols
+      }
+      else
+        n = ncol(x)
+      
       if (n != private$nrows || n != private$ncols)
         stop(paste0("hdfmat dimension ", private$nrows, "x", private$ncols, " different from crossprod of input ", n, "x", n))
       
+      private$flush(overwrite=TRUE)
+      private$invalidate()
+      
+      if (is_hdfmat(x))
+      {
+        x$compute()
+        .Call(R_hdfmat_cp_ooc, p$nrows, p$ncols, p$ds, p$storage, private$ds, private$type, private$storage, mem)
+        return(invisible(self))
+      }
+      
       if (private$type == TYPE_DOUBLE)
       {
         if (float::is.float(x))
@@ -289,7 +571,7 @@ hdfmatR6 = R6::R6Class("cpumat",
         else if (typeof(x) != "double")
           storage.mode(x) = "double"
       }
-      else # if (private$type == TYPE_FLOAT)
+      else # float and the compact types
       {
         if (!float::is.float(x))
           x = float::fl(x)@Data
@@ -297,7 +579,7 @@ hdfmatR6 = R6::R6Class("cpumat",
           x = x@Data
       }
       
-      .Call(R_hdfmat_cp, x, private$ds, private$type)
+      .Call(R_hdfmat_cp, x, private$ds, private$type, private$storage, mem)
       invisible(self)
     },
     
@@ -307,12 +589,85 @@ hdfmatR6 = R6::R6Class("cpumat",
     #' stored in an hdfmat. Useful when the number of columns of the input is
     #' very large.
     #' @param x Input matrix. Fundamental type can be double, float, or int.
-    fill_tcrossprod = function(x)
+    #' Can also be an hdfmat other than this one, which is streamed from disk
+    #' in blocks of rows.
+    #' @param mem Memory budget (in MiB) for the band of result rows computed
+    #' and written at a time. With an hdfmat input, half of it goes to the
+    #' result band and half to the rows of the input read at a time.
+    fill_tcrossprod = function(x, mem=64)
     {
-      m = nrow(x)
+      if (identical(x, self))
+        stop("'x' cannot be the hdfmat being filled")
+      mem = check_mem(mem)
+      
+      if (is_hdfmat(x))
+      {
+        p = hdfmat_private(x)
+        m = p$nrows
+      }
+      else
+        m = nrow(x)
+      
       if (m != private$nrows || m != private$ncols)
         stop(paste0("hdfmat dimension ", private$nrows, "x", private$ncols, " different from crossprod of input ", m, "x", m))
       
+      private$flush(overwrite=TRUE)
+      private$invalidate()
+      
+      if (is_hdfmat(x))
+      {
+        x$compute()
+        .Call(R_hdfmat_tcp_ooc, p$nrows, p$ncols, p$ds, p$storage, private$ds, private$type, private$storage, mem)
+        return(invisible(self))
+      }
+      
+      if (private$type == TYPE_DOUBLE)
+      {
+        if (float::is.float(x))
+          x = float::dbl(x)
+        else if (typeof(x) != "double")
+          storage.mode(x) = "double"
+      }
+      else # float and the compact types
+      {
+        if (!float::is.float(x))
+          x = float::fl(x)@Data
+        else
+          x = x@Data
+      }
+      
+      .Call(R_hdfmat_tcp, x, private$ds, private$type, private$storage, mem)
+      invisible(self)
+    },
+    
+    
+    #' @details
+    #' Multiply the hdfmat-stored matrix A by an in-memory matrix, streaming
+    #' the rows of A from disk in one pass.
+    #' @param x An in-memory matrix, usually with few columns. Its number of
+    #' rows must match \code{ncol(A)}, or \code{nrow(A)} if \code{trans=TRUE}.
+    #' @param trans If \code{TRUE}, compute \code{t(A) \%*\% x} instead of
+    #' \code{A \%*\% x}.
+    #' @param mem Memory budget (in MiB) for the blocks of rows read from
+    #' disk.
+    #' @param out An optional hdfmat with full storage and the dimension of the
+    #' product. If given, the product is written to it instead of being
+    #' returned.
+    #' @return The product as a matrix of the hdfmat's type, or \code{out}
+    #' (invisibly).
+    matmult = function(x, trans=FALSE, mem=64, out=NULL)
+    {
+      private$flush()
+      mem = check_mem(mem)
+      trans = isTRUE(trans)
+      
+      if (!is.matrix(x) && !float::is.float(x))
+        x = as.matrix(x)
+      
+      inner = if (trans) private$nrows else private$ncols
+      if (nrow(x) != inner)
+        stop(paste0("non-conformable: hdfmat is ", private$nrows, "x", private$ncols, " and x has ", nrow(x), " rows"))
+      
       if (private$type == TYPE_DOUBLE)
       {
         if (float::is.float(x))
@@ -320,7 +675,7 @@ hdfmatR6 = R6::R6Class("cpumat",
         else if (typeof(x) != "double")
           storage.mode(x) = "double"
       }
-      else # if (private$type == TYPE_FLOAT)
+      else # float and the compact types
       {
         if (!float::is.float(x))
           x = float::fl(x)@Data
@@ -328,25 +683,172 @@ hdfmatR6 = R6::R6Class("cpumat",
           x = x@Data
       }
       
-      .Call(R_hdfmat_tcp, x, private$ds, private$type)
+      if (!is.null(out))
+      {
+        if (!is_hdfmat(out))
+          stop("'out' must be an hdfmat")
+        
+        p = hdfmat_private(out)
+        if (p$storage != STORAGE_FULL)
+          stop("'out' must have full storage")
+        if (p$nrows != (if (trans) private$ncols else private$nrows) || p$ncols != ncol(x))
+          stop("'out' has the wrong dimension for the product")
+        
+        p$flush(overwrite=TRUE)
+        p$invalidate()
+        .Call(R_hdfmat_matmult_ooc, private$nrows, private$ncols, private$ds, x, trans, private$type, private$storage, mem, p$ds)
+        return(invisible(out))
+      }
+      
+      ret = .Call(R_hdfmat_matmult, private$nrows, private$ncols, private$ds, x, trans, private$type, private$storage, mem)
+      if (private$type != TYPE_DOUBLE)
+        ret = float::float32(ret)
+      
+      ret
+    },
+    
+    
+    #' @details
+    #' Fill the hdfmat with the product of two hdfmats, \code{x \%*\% y},
+    #' without holding either in memory. See \code{\link{matmult_ooc}}.
+    #' @param x,y The factors, hdfmats of the same type as this one and other
+    #' than it.
+    #' @param mem Memory budget (in MiB) for the tiles of the factors and the
+    #' result held at a time.
+    fill_matmult = function(x, y, mem=64)
+    {
+      private$check_full("fill_matmult")
+      mem = check_mem(mem)
+      
+      if (!is_hdfmat(x) || !is_hdfmat(y))
+        stop("'x' and 'y' must be hdfmats")
+      if (identical(x, self) || identical(y, self))
+        stop("'x' and 'y' cannot be the hdfmat being filled")
+      
+      px = hdfmat_private(x)
+      py = hdfmat_private(y)
+      if (px$type != private$type || py$type != private$type)
+        stop("'x', 'y', and the result must have the same type")
+      if (px$ncols != py$nrows)
+        stop(paste0("non-conformable arguments: ", px$nrows, "x", px$ncols, " and ", py$nrows, "x", py$ncols))
+      if (px$nrows != private$nrows || py$ncols != private$ncols)
+        stop(paste0("hdfmat dimension ", private$nrows, "x", private$ncols, " different from product ", px$nrows, "x", py$ncols))
+      
+      private$flush(overwrite=TRUE)
+      private$invalidate()
+      x$compute()
+      y$compute()
+      .Call(R_hdfmat_gemm_ooc, px$nrows, px$ncols, py$ncols, px$ds, px$storage, py$ds, py$storage, private$ds, private$type, mem)
       invisible(self)
     },
     
     
+    #' @details
+    #' Compute reductions of the matrix in a single pass over the data. All
+    #' sums are accumulated in double precision.
+    #' @param what Any of "rowSums", "colSums", "rowMeans", "colMeans",
+    #' "rowNorms", "colNorms" (Euclidean norms of the rows/columns), "norm"
+    #' (the Frobenius norm), "min", "max", and "trace". However many are
+    #' requested, the data is read once.
+    #' @param simplify If \code{TRUE} and only one reduction is requested,
+    #' return it instead of a list.
+    #' @return A named list of the reductions, or a single one.
+    reduce = function(what=REDUCTIONS_STR, simplify=TRUE)
+    {
+      private$flush()
+      what = match.arg(what, REDUCTIONS_STR, several.ok=TRUE)
+      
+      flags = 0L
+      if (any(c("rowSums", "rowMeans", "rowNorms", "norm") %in% what))
+        flags = bitwOr(flags, REDUCE_ROWS)
+      if (any(c("colSums", "colMeans", "colNorms") %in% what))
+        flags = bitwOr(flags, REDUCE_COLS)
+      if ("trace" %in% what)
+      {
+        if (private$nrows != private$ncols)
+          stop("trace of a non-square matrix")
+        flags = bitwOr(flags, REDUCE_TRACE)
+      }
+      
+      r = .Call(R_hdfmat_reduce, private$nrows, private$ncols, private$ds, flags, private$type, private$storage)
+      
+      ret = lapply(what, function(w) switch(w,
+        rowSums = r[[1]],
+        colSums = r[[3]],
+        rowMeans = r[[1]] / private$ncols,
+        colMeans = r[[3]] / private$nrows,
+        rowNorms = sqrt(r[[2]]),
+        colNorms = sqrt(r[[4]]),
+        norm = sqrt(sum(r[[2]])),
+        min = r[[5]],
+        max = r[[6]],
+        trace = r[[7]]
+      ))
+      names(ret) = what
+      
+      if (isTRUE(simplify) && length(ret) == 1)
+        ret[[1]]
+      else
+        ret
+    },
+    
+    
     #' @details
     #' Compute approximations to the eigenvalues of a square symmetric
-    #' hdfmat-stored matrix using the Lanczos method. The matrix is not checked
-    #' for symmetry.
-    #' @param k The number of Lanczos iterations.
-    eigen = function(k=3)
+    #' hdfmat-stored matrix using the Lanczos method or a randomized method.
+    #' The matrix is not checked for symmetry.
+    #' @param k The number of Lanczos iterations, or the number of eigenvalues
+    #' for the randomized method.
+    #' @param mem Memory budget (in MiB) for the blocks of rows read from
+    #' disk for each matrix-vector product.
+    #' @param block Block size for the block Lanczos method. Each pass over the
+    #' data multiplies by \code{block} vectors at once, so only
+    #' \code{ceiling(k/block)} passes are needed. The default 1 is the
+    #' ordinary Lanczos method.
+    #' @param method Either "lanczos" or "randomized". The randomized method
+    #' uses a Gaussian sketch with \code{k+10} columns and reads the data
+    #' exactly \code{passes} times.
+    #' @param passes The number of passes over the data for the randomized
+    #' method, at least 2. Each pass beyond 2 is a power iteration.
+    #' @param seed Seed for the random start vectors (or sketch). If
+    #' \code{NULL}, a seed is drawn from R's generator.
+    #' @param mixed For float matrices and the Lanczos method, run the
+    #' recurrence in double precision on the float data, which is read at
+    #' float cost but keeps the Lanczos vectors orthogonal much longer. The
+    #' values are then returned as double. Ignored otherwise.
+    eigen = function(k=3, mem=64, block=1, method="lanczos", passes=4, seed=NULL, mixed=FALSE)
     {
       if (private$nrows != private$ncols)
         stop("matrix is non-square")
       
+      private$flush()
+      method = match.arg(tolower(method), c("lanczos", "randomized"))
       k = as.integer(k)
       n = as.double(private$nrows)
-      values = .Call(R_hdfmat_eigen_sym, k, n, private$ds, private$type)
-      if (private$type == TYPE_FLOAT)
+      mem = check_mem(mem)
+      seed = check_seed(seed)
+      
+      if (method == "randomized")
+      {
+        passes = check_passes(passes)
+        l = as.integer(min(k + 10, n))
+        if (k > l)
+          stop("'k' larger than the matrix dimension")
+        
+        values = .Call(R_hdfmat_reigen_sym, k, l, passes, n, private$ds, private$type, private$storage, mem, seed)
+      }
+      else
+      {
+        block = as.integer(block)
+        if (length(block) != 1 || is.na(block) || block < 1)
+          stop("'block' must be a positive integer")
+        if (block * ceiling(k/block) > n)
+          stop("'block' too large for the matrix dimension")
+        
+        values = .Call(R_hdfmat_eigen_sym, k, n, private$ds, private$type, private$storage, mem, block, seed, isTRUE(mixed))
+      }
+      
+      if (private$type != TYPE_DOUBLE && !is.double(values))
         values = float::float32(values)
       
       values
@@ -355,13 +857,45 @@ hdfmatR6 = R6::R6Class("cpumat",
     
     #' @details
     #' Compute approximations to the singular values of a rectangular
-    #' hdfmat-stored matrix using the Lanczos method.
-    #' @param k The number of Lanczos iterations.
-    svd = function(k=3)
+    #' hdfmat-stored matrix using the Lanczos method or a randomized method.
+    #' @param k The number of Lanczos iterations, or the number of singular
+    #' values for the randomized method.
+    #' @param mem Memory budget (in MiB) for the blocks of rows read from
+    #' disk for each matrix-vector product.
+    #' @param method Either "lanczos" or "randomized". The randomized method
+    #' uses a Gaussian sketch with \code{k+10} columns and reads the data
+    #' exactly \code{passes} times.
+    #' @param passes The number of passes over the data for the randomized
+    #' method, at least 2. Every 2 passes beyond 2 add a power iteration.
+    #' @param seed Seed for the random start vector (or sketch). If
+    #' \code{NULL}, a seed is drawn from R's generator.
+    #' @param mixed For float matrices and the Lanczos method, run the
+    #' recurrence in double precision on the float data. The values are then
+    #' returned as double. Ignored otherwise.
+    svd = function(k=3, mem=64, method="lanczos", passes=4, seed=NULL, mixed=FALSE)
     {
+      private$flush()
+      method = match.arg(tolower(method), c("lanczos", "randomized"))
       k = as.integer(k)
-      values = .Call(R_hdfmat_svd, k, private$nrows, private$ncols, private$ds, private$type)
-      if (private$type == TYPE_FLOAT)
+      mem = check_mem(mem)
+      seed = check_seed(seed)
+      
+      if (method == "randomized")
+      {
+        passes = check_passes(passes)
+        l = as.integer(min(k + 10, private$nrows, private$ncols))
+        if (k > l)
+          stop("'k' larger than the smallest matrix dimension")
+        
+        values = .Call(R_hdfmat_rsvd, k, l, passes, private$nrows, private$ncols, private$ds, private$type, private$storage, mem, seed)
+      }
+      else
+      {
+        private$check_full("svd(method=\"lanczos\")")
+        values = .Call(R_hdfmat_svd, k, private$nrows, private$ncols, private$ds, private$type, mem, seed, isTRUE(mixed))
+      }
+      
+      if (private$type != TYPE_DOUBLE && !is.double(values))
         values = float::float32(values)
       
       values
@@ -392,27 +926,109 @@ hdfmatR6 = R6::R6Class("cpumat",
       private$nrows = ret[[2]][1]
       private$ncols = ret[[2]][2]
       private$type = ret[[3]]
+      private$storage = ret[[4]]
+      private$chunking = ret[[5]]
+      
+      filters = ret[[7]]
+      names(filters) = FILTERS_STR[ret[[6]]]
+      private$filters = filters
     },
     
     
-    create = function(file, name, nrows, ncols, type, compression)
+    create = function(file, name, nrows, ncols, type, compression, storage, chunking, filters, digits, precision)
     {
-      type = match.arg(tolower(type), c("double", "float"))
+      type = match.arg(tolower(type), TYPES_STR)
       type = type_str2int(type)
       
       compression = as.integer(compression)
       if (!(compression %in% 0L:9L))
         stop("'compression' must be an integer from 0 to 9")
       
+      storage = match.arg(tolower(storage), STORAGES_STR)
+      storage = match(storage, STORAGES_STR)
+      
       nrows = as.double(nrows)
       ncols = as.double(ncols)
       
+      if (storage == STORAGE_SYM && nrows != ncols)
+        stop("symmetric storage requires a square matrix")
+      
+      filters = check_filters(filters, compression, digits, precision)
+      
+      chunking = match.arg(tolower(chunking), c("auto", CHUNKINGS_STR))
+      if (chunking == "auto")
+      {
+        if (storage == STORAGE_SYM || length(filters) > 0)
+          chunking = "tiles"
+        else
+          chunking = "contiguous"
+      }
+      
+      if (type == TYPE_INT8 && storage == STORAGE_SYM)
+        stop("int8 matrices do not support symmetric storage")
+      if (type >= TYPE_FLOAT16 && any(names(filters) %in% c("nbit", "scaleoffset")))
+        stop("the nbit and scaleoffset filters do not apply to compact types")
+      if (storage == STORAGE_SYM && chunking != "tiles")
+        stop("symmetric storage requires chunking=\"tiles\"")
+      if (length(filters) > 0 && chunking == "contiguous")
+        stop("compression and filters require a chunked layout")
+      
       private$nrows = nrows
       private$ncols = ncols
       private$type = type
+      private$storage = storage
+      private$chunking = chunking
+      private$filters = filters
       
       private$open(file=file, name=name, mode=FILE_MODE_CR)
-      private$ds = .Call(R_hdfmat_init, private$fp, name, nrows, ncols, type, compression)
+      private$ds = .Call(R_hdfmat_init, private$fp, name, nrows, ncols, type, storage, match(chunking, CHUNKINGS_STR), match(names(filters), FILTERS_STR), unname(filters))
+    },
+    
+    
+    record = function(op, a=0, b=0)
+    {
+      private$ops = c(private$ops, op)
+      private$op_args = c(private$op_args, a, b)
+    },
+    
+    
+    # apply the pending element-wise ops before the data is read or partly
+    # written; a write of the whole matrix drops them instead
+    flush = function(overwrite=FALSE)
+    {
+      if (isTRUE(overwrite))
+      {
+        private$ops = integer(0)
+        private$op_args = numeric(0)
+      }
+      else
+        self$compute()
+    },
+    
+    
+    # set the elements with first <= j - i <= last to v (recycled along the
+    # rows)
+    set_band = function(v, first, last)
+    {
+      private$flush()
+      private$invalidate()
+      v = as.double(v)
+      .Call(R_hdfmat_fill_band, private$nrows, private$ncols, private$ds, v, as.double(first), as.double(last), private$type, private$storage)
+    },
+    
+    
+    # drop cached rows [row_start, row_stop] (0-based), or all of them
+    invalidate = function(row_start=0, row_stop=-1)
+    {
+      if (!is.null(private$rcache))
+        .Call(R_hdfmat_cache_invalidate, private$rcache, as.double(row_start), as.double(row_stop))
+    },
+    
+    
+    check_full = function(method)
+    {
+      if (private$storage != STORAGE_FULL)
+        stop(paste0(method, " is not supported for ", storage_int2str(private$storage), " storage"))
     },
     
     
@@ -421,8 +1037,10 @@ hdfmatR6 = R6::R6Class("cpumat",
       if (is.null(private$fp))
         return(invisible(self))
       
+      private$flush()
       .Call(R_hdfmat_finalize, private$fp, private$ds)
       
+      private$rcache = NULL
       private$ds = NULL
       private$fp = NULL
       invisible(gc())
@@ -435,6 +1053,12 @@ hdfmatR6 = R6::R6Class("cpumat",
     nrows = 0,
     ncols = 0,
     type = 0L,
+    storage = STORAGE_FULL,
+    chunking = "contiguous",
+    filters = integer(0),
+    ops = integer(0),
+    op_args = numeric(0),
+    rcache = NULL,
     fp = NULL,
     ds = NULL
   )
@@ -449,18 +1073,49 @@ hdfmatR6 = R6::R6Class("cpumat",
 #' @param file File to store data in.
 #' @param name Dataset name on disk.
 #' @param nrows,ncols The dimension of the matrix.
-#' @param type Storage type for the matrix. Should be one of 'int', 'float', or
-#' 'double'.
+#' @param type Storage type for the matrix. Should be one of 'double', 'float',
+#' or one of the compact types 'float16', 'bfloat16', and 'int8'. Compact
+#' matrices are read as float and computed on in float; 'int8' stores a float
+#' scale per row (in the dataset \code{<name>_scale}), can not use symmetric
+#' storage, and can not hold NaN or infinite values.
 #' @param compression The compression level, an integer from 0 (no compression)
 #' to 9 (highest compression). Run-time performance degrades with increased
 #' compression levels.
+#' @param storage Either "full" or "symmetric". Symmetric storage requires a
+#' square matrix and only keeps the tiles on and above the diagonal on disk,
+#' roughly halving disk usage and I/O. Values written below the diagonal are
+#' ignored.
+#' @param chunking The on-disk layout. "rows" chunks hold whole rows, "cols"
+#' chunks are tall blocks of columns, and "tiles" chunks are near-square; all
+#' are sized to about 1 MiB. "contiguous" stores the matrix unchunked and
+#' cannot be compressed. The default "auto" uses tiles for compressed or
+#' symmetric matrices, which keeps column-subset reads from decompressing
+#' whole rows, and contiguous storage otherwise. The choice is recorded in the
+#' file, and each dataset gets a chunk cache that holds a row of its chunks.
+#' Contiguous matrices are read through a memory map of the file where the
+#' platform allows it, so \code{read()} and the streaming kernels use the
+#' file's pages directly.
+#' @param filters The filter pipeline, any of "shuffle", "deflate", "nbit",
+#' and "scaleoffset". They are always applied in the order n-bit or
+#' scale-offset, then shuffle, then deflate, and are read back by
+#' \code{hdfmat_open()}. Shuffle groups the bytes of the values so that
+#' deflate finds more redundancy; with it, low deflate levels usually
+#' compress much better at little CPU cost. "nbit" keeps only
+#' \code{precision} mantissa bits and "scaleoffset" keeps \code{digits}
+#' decimal digits; both are lossy for float data. A positive
+#' \code{compression} level adds deflate. Matrices filtered with deflate
+#' alone, or shuffle then deflate, are decompressed on all cores when read
+#' and compressed on all cores when whole chunks are written.
+#' @param digits The number of decimal digits kept by the scale-offset filter.
+#' @param precision The number of mantissa bits kept by the n-bit filter (at
+#' most 52 for double and 23 for float).
 #' 
 #' @return An hdfmat class object.
 #' 
 #' @export
-hdfmat = function(file, name, nrows, ncols, type="double", compression=0L)
+hdfmat = function(file, name, nrows, ncols, type="double", compression=0L, storage="full", chunking="auto", filters=NULL, digits=4L, precision=16L)
 {
-  hdfmatR6$new(open=FALSE, file=file, name=name, nrows=nrows, ncols=ncols, type=type, compression=compression)
+  hdfmatR6$new(open=FALSE, file=file, name=name, nrows=nrows, ncols=ncols, type=type, compression=compression, storage=storage, chunking=chunking, filters=filters, digits=digits, precision=precision)
 }
 
 
@@ -0,0 +1,42 @@
+#' matmult_ooc
+#' 
+#' Out-of-core matrix product of two hdfmats.
+#' 
+#' @details
+#' If \code{y} fits in half of the memory budget it is read once and the rows
+#' of \code{x} are streamed through it. Otherwise bands of rows of \code{x}
+#' stay in memory while blocks of columns of \code{y} are streamed past them,
+#' so \code{x} is read once and \code{y} once per band. The result is written
+#' tile by tile while the next tile is read.
+#' 
+#' @param x,y
+#' The factors, hdfmats of the same type.
+#' @param file
+#' Name of the file to use for the out-of-core storage. Must not be the file
+#' of \code{x} or \code{y}.
+#' @param name
+#' The dataset name within the HDF5 file.
+#' @param compression The compression level, an integer from 0 (no compression)
+#' to 9 (highest compression). Run-time performance degrades with increased
+#' compression levels.
+#' @param mem Memory budget (in MiB) for the tiles of the factors and the
+#' result held at a time.
+#' 
+#' @return Returns an hdfmat object.
+#' 
+#' @export
+matmult_ooc = function(x, y, file, name="matmult", compression=0L, mem=64)
+{
+  if (!is_hdfmat(x) || !is_hdfmat(y))
+    stop("'x' and 'y' must be hdfmats")
+  
+  file = normalizePath(file, winslash="/", mustWork=FALSE)
+  if (file %in% c(hdfmat_private(x)$file, hdfmat_private(y)$file))
+    stop("'file' is in use by an input")
+  
+  type = type_int2str(hdfmat_private(x)$type)
+  h = hdfmat(file, name, x$dim()[1], y$dim()[2], type, compression=compression)
+  h$fill_matmult(x, y, mem=mem)
+  
+  h
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+
+#include "cache.hh"
+#include "panel.hh"
+
+#include "hdfmat.h"
+#include "extptr.h"
+#include "types.h"
+
+
+// rows per cached block: about CACHE_BLOCK_BYTES, whole rows of chunks if
+// they fit, so a miss rarely decompresses a chunk that the neighboring block
+// needs as well
+static inline hsize_t cache_block_rows(const hsize_t m, const hsize_t n,
+  const size_t size, H5::DataSet *dataset)
+{
+  const double mem = (double)CACHE_BLOCK_BYTES / (1024.0*1024.0);
+  return panel_rows_stored(m, n, size, mem, STORAGE_FULL, dataset);
+}
+
+extern "C" SEXP R_hdfmat_cache_new(SEXP m_, SEXP n_, SEXP ds, SEXP type,
+  SEXP mem_)
+{
+  SEXP ret;
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  
+  const hsize_t m = (hsize_t) DBL(m_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const size_t size = (INT(type) == TYPE_DOUBLE) ? sizeof(double) : sizeof(float);
+  const size_t max_bytes = (size_t) (DBL(mem_) * 1024.0 * 1024.0);
+  
+  row_cache *cache;
+  TRY_CATCH( cache = new row_cache(max_bytes, cache_block_rows(m, n, size, dataset)) );
+  
+  newRptr(cache, ret, hdf_object_finalizer<row_cache>);
+  UNPROTECT(1);
+  return ret;
+}
+
+
+
+// drop the blocks holding rows [row_start, row_stop], or all of them if
+// row_stop is negative
+extern "C" SEXP R_hdfmat_cache_invalidate(SEXP cache_, SEXP row_start_,
+  SEXP row_stop_)
+{
+  row_cache *cache = (row_cache*) getRptr(cache_);
+  if (cache == NULL)
+    return R_NilValue;
+  
+  const double row_start = DBL(row_start_);
+  const double row_stop = DBL(row_stop_);
+  
+  std::lock_guard<std::mutex> lock(cache->mutex());
+  if (row_stop < 0)
+    cache->clear();
+  else
+    cache->invalidate((hsize_t)row_start / cache->rows(), (hsize_t)row_stop / cache->rows());
+  
+  return R_NilValue;
+}
+
+
+
+extern "C" SEXP R_hdfmat_cache_info(SEXP cache_)
+{
+  SEXP ret;
+  row_cache *cache = (row_cache*) getRptr(cache_);
+  
+  PROTECT(ret = allocVector(REALSXP, 5));
+  std::lock_guard<std::mutex> lock(cache->mutex());
+  REAL(ret)[0] = cache->hits;
+  REAL(ret)[1] = cache->misses;
+  REAL(ret)[2] = (double) cache->size();
+  REAL(ret)[3] = (double) cache->limit();
+  REAL(ret)[4] = (double) cache->rows();
+  
+  UNPROTECT(1);
+  return ret;
+}
@@ -0,0 +1,145 @@
+#ifndef HDFMAT_CACHE_H
+#define HDFMAT_CACHE_H
+#pragma once
+
+
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+#include <H5Cpp.h>
+
+
+// LRU cache of decoded blocks of block_rows full rows of one dataset, bounded
+// by max_bytes. Blocks are keyed by their index (first row / block_rows), so
+// overlapping reads of nearby rows share them. Column-major reads fill it from
+// their stream thread, so every use holds mutex(); the data returned by get()
+// and put() stays valid only while it is held.
+class row_cache
+{
+  public:
+    row_cache(const size_t max_bytes, const hsize_t block_rows);
+    ~row_cache() {clear();};
+    
+    void* get(const hsize_t block);
+    void* put(const hsize_t block, const size_t len);
+    void invalidate(const hsize_t block_first, const hsize_t block_last);
+    void clear();
+    
+    hsize_t rows() const {return block_rows;};
+    size_t limit() const {return max_bytes;};
+    size_t size() const {return bytes;};
+    std::mutex& mutex() {return mtx;};
+    double hits;
+    double misses;
+  
+  private:
+    struct entry
+    {
+      hsize_t block;
+      size_t bytes;
+      void *data;
+    };
+    
+    size_t max_bytes;
+    hsize_t block_rows;
+    size_t bytes;
+    std::list<entry> lru;
+    std::unordered_map<hsize_t, std::list<entry>::iterator> map;
+    std::mutex mtx;
+    
+    void evict();
+};
+
+
+
+inline row_cache::row_cache(const size_t max_bytes, const hsize_t block_rows)
+: hits(0), misses(0), max_bytes(max_bytes), block_rows(block_rows), bytes(0)
+{}
+
+
+
+// the block's data, most recently used now, or NULL if it is not cached
+inline void* row_cache::get(const hsize_t block)
+{
+  auto it = map.find(block);
+  if (it == map.end())
+  {
+    misses++;
+    return NULL;
+  }
+  
+  hits++;
+  lru.splice(lru.begin(), lru, it->second);
+  return it->second->data;
+}
+
+
+
+// room for a new block, evicting the least recently used ones as needed; NULL
+// if the block alone is over the limit
+inline void* row_cache::put(const hsize_t block, const size_t len)
+{
+  if (len > max_bytes)
+    return NULL;
+  
+  while (bytes + len > max_bytes)
+    evict();
+  
+  void *data = std::malloc(len);
+  if (data == NULL)
+    throw std::bad_alloc();
+  
+  lru.push_front({block, len, data});
+  map[block] = lru.begin();
+  bytes += len;
+  
+  return data;
+}
+
+
+
+inline void row_cache::invalidate(const hsize_t block_first,
+  const hsize_t block_last)
+{
+  for (auto it=lru.begin(); it!=lru.end(); )
+  {
+    if (it->block >= block_first && it->block <= block_last)
+    {
+      bytes -= it->bytes;
+      std::free(it->data);
+      map.erase(it->block);
+      it = lru.erase(it);
+    }
+    else
+      ++it;
+  }
+}
+
+
+
+inline void row_cache::clear()
+{
+  for (auto &e : lru)
+    std::free(e.data);
+  
+  lru.clear();
+  map.clear();
+  bytes = 0;
+}
+
+
+
+inline void row_cache::evict()
+{
+  entry &e = lru.back();
+  bytes -= e.bytes;
+  std::free(e.data);
+  map.erase(e.block);
+  lru.pop_back();
+}
+
+
+#endif
@@ -0,0 +1,406 @@
+#ifndef HDFMAT_CHUNKS_H
+#define HDFMAT_CHUNKS_H
+#pragma once
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <H5Cpp.h>
+#include <zlib.h>
+
+#include "omp.h"
+#include "stats.hh"
+#include "types.h"
+
+
+// Reads and writes of deflated datasets with the (de)compression spread over
+// threads. HDF5 runs the filter pipeline inside H5Dread and H5Dwrite on the
+// calling thread, so a compressed panel read or write keeps one core busy
+// while the others wait. Instead, read_chunks() fetches the raw chunks
+// covering a block with H5Dread_chunk and then inflates, unshuffles, and
+// copies them into place in parallel with zlib; write_chunks() assembles,
+// shuffles, and deflates whole chunks in parallel and commits them with
+// H5Dwrite_chunk. Only the raw-byte I/O happens in the library, on the
+// calling thread; no HDF5 calls are made from the worker threads.
+//
+// Only the pipelines deflate and shuffle + deflate on a file type equal to
+// the memory type are handled, and writes must cover whole chunks. For
+// anything else (other filters, type conversion, chunks not yet allocated on
+// reads, partial chunks on writes, HDF5 older than 1.10.2) these return false
+// and the caller goes through HDF5.
+//
+// Most calls come from the background thread of a panel_stream (stream.hh)
+// while the R thread computes on the previous panel. The stream thread is
+// new for every panel, so OpenMP starts a new team for it each time, next to
+// the R thread's own team and the BLAS threads. The parallel regions there
+// are capped at half the threads (see omp_threads()), and a single chunk is
+// handled without a team at all.
+
+// chunk dimensions of a dataset these can handle, whether its pipeline
+// shuffles, and its deflate level
+static inline bool chunk_pipeline(H5::DataSet *dataset, H5::PredType h5type,
+  hsize_t dim_chunk[2], bool *shuffle, int *level)
+{
+  H5::DSetCreatPropList plist = dataset->getCreatePlist();
+  if (plist.getLayout() != H5D_CHUNKED)
+    return false;
+  
+  if (!(dataset->getDataType() == h5type))
+    return false;
+  
+  const int n = plist.getNfilters();
+  H5Z_filter_t ids[2];
+  if (n < 1 || n > 2)
+    return false;
+  
+  for (int i=0; i<n; i++)
+  {
+    unsigned int flags, config;
+    unsigned int cd_values[8];
+    size_t cd_nelmts = 8;
+    char filter_name[64];
+    ids[i] = plist.getFilter(i, flags, cd_nelmts, cd_values, 64, filter_name, config);
+    if (ids[i] == H5Z_FILTER_DEFLATE)
+      *level = (cd_nelmts > 0) ? (int) cd_values[0] : Z_DEFAULT_COMPRESSION;
+  }
+  
+  if (ids[n-1] != H5Z_FILTER_DEFLATE || (n == 2 && ids[0] != H5Z_FILTER_SHUFFLE))
+    return false;
+  
+  plist.getChunk(2, dim_chunk);
+  *shuffle = (n == 2);
+  return true;
+}
+
+
+
+// the shuffle filter: byte b of element i is stored at b*len + i
+static inline void shuffle_bytes(const unsigned char *in, unsigned char *out,
+  const size_t len, const size_t size)
+{
+  for (size_t b=0; b<size; b++)
+  {
+    unsigned char *out_b = out + b*len;
+    for (size_t i=0; i<len; i++)
+      out_b[i] = in[i*size + b];
+  }
+}
+
+static inline void unshuffle(const unsigned char *in, unsigned char *out,
+  const size_t len, const size_t size)
+{
+  for (size_t b=0; b<size; b++)
+  {
+    const unsigned char *in_b = in + b*len;
+    for (size_t i=0; i<len; i++)
+      out[i*size + b] = in_b[i];
+  }
+}
+
+
+
+// read the rows x cols block at (row_start, col_start) into the row-major x;
+// false if the dataset needs the library's own read path
+template <typename T>
+static inline bool read_chunks(const hsize_t row_start, const hsize_t rows,
+  const hsize_t col_start, const hsize_t cols, T *x, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+#if H5_VERSION_GE(1,10,2)
+  hsize_t dim_chunk[2];
+  bool shuffle;
+  int level;
+  if (rows == 0 || cols == 0 || !chunk_pipeline(dataset, h5type, dim_chunk, &shuffle, &level))
+    return false;
+  
+  const hsize_t cr = dim_chunk[0];
+  const hsize_t cc = dim_chunk[1];
+  const hsize_t r0 = row_start / cr;
+  const hsize_t c0 = col_start / cc;
+  const hsize_t nrc = (row_start + rows - 1)/cr - r0 + 1;
+  const hsize_t ncc = (col_start + cols - 1)/cc - c0 + 1;
+  const hsize_t nchunks = nrc * ncc;
+  
+  // edge chunks are stored at full size
+  const size_t chunk_len = (size_t) (cr*cc);
+  const size_t chunk_bytes = chunk_len * sizeof(T);
+  
+  const hid_t ds_id = dataset->getId();
+  std::vector<size_t> off(nchunks + 1);
+  std::vector<uint32_t> mask(nchunks);
+  
+  auto chunk_offset = [&](const hsize_t k, hsize_t *offset) {
+    offset[0] = (r0 + k/ncc) * cr;
+    offset[1] = (c0 + k%ncc) * cc;
+  };
+  
+  off[0] = 0;
+  for (hsize_t k=0; k<nchunks; k++)
+  {
+    hsize_t offset[2];
+    chunk_offset(k, offset);
+    
+    hsize_t size = 0;
+    herr_t err;
+    H5E_BEGIN_TRY { err = H5Dget_chunk_storage_size(ds_id, offset, &size); } H5E_END_TRY;
+    if (err < 0 || size == 0)
+      return false;
+    
+    off[k+1] = off[k] + (size_t) size;
+  }
+  
+  unsigned char *raw = (unsigned char*) std::malloc(off[nchunks]);
+  if (raw == NULL)
+    throw std::bad_alloc();
+  
+  for (hsize_t k=0; k<nchunks; k++)
+  {
+    hsize_t offset[2];
+    chunk_offset(k, offset);
+    
+    herr_t err;
+    H5E_BEGIN_TRY { err = H5Dread_chunk(ds_id, H5P_DEFAULT, offset, &mask[k], raw + off[k]); } H5E_END_TRY;
+    if (err < 0)
+    {
+      std::free(raw);
+      return false;
+    }
+  }
+  
+  // 1 if a worker could not allocate its buffers, 2 if a chunk did not
+  // decode; both leave the read to HDF5
+  int bad = 0;
+  
+  const int nt = omp_threads(stats_in_stream());
+  #pragma omp parallel num_threads(nt) if(nchunks > 1)
+  {
+    unsigned char *tmp = (unsigned char*) std::malloc(2*chunk_bytes);
+    if (tmp == NULL)
+    {
+      #pragma omp atomic write
+      bad = 1;
+    }
+    
+    #pragma omp for schedule(dynamic)
+    for (hsize_t k=0; k<nchunks; k++)
+    {
+      if (tmp == NULL)
+        continue;
+      
+      // a set mask bit means the filter was skipped for this chunk
+      const bool deflated = !(mask[k] & (shuffle ? 2u : 1u));
+      const bool shuffled = shuffle && !(mask[k] & 1u);
+      
+      const unsigned char *src = raw + off[k];
+      const size_t len = off[k+1] - off[k];
+      if (deflated)
+      {
+        uLongf dlen = (uLongf) chunk_bytes;
+        if (uncompress(tmp, &dlen, src, (uLong) len) != Z_OK || dlen != chunk_bytes)
+        {
+          #pragma omp atomic write
+          bad = 2;
+          continue;
+        }
+        
+        src = tmp;
+      }
+      else if (len != chunk_bytes)
+      {
+        #pragma omp atomic write
+        bad = 2;
+        continue;
+      }
+      
+      if (shuffled)
+      {
+        unshuffle(src, tmp + chunk_bytes, chunk_len, sizeof(T));
+        src = tmp + chunk_bytes;
+      }
+      
+      // the part of the chunk inside the block
+      hsize_t offset[2];
+      chunk_offset(k, offset);
+      const hsize_t i0 = std::max(offset[0], row_start);
+      const hsize_t i1 = std::min(offset[0] + cr, row_start + rows);
+      const hsize_t j0 = std::max(offset[1], col_start);
+      const hsize_t j1 = std::min(offset[1] + cc, col_start + cols);
+      
+      for (hsize_t i=i0; i<i1; i++)
+      {
+        const unsigned char *src_i = src + ((i - offset[0])*cc + (j0 - offset[1]))*sizeof(T);
+        std::memcpy(x + (i - row_start)*cols + (j0 - col_start), src_i, (j1 - j0)*sizeof(T));
+      }
+    }
+    
+    std::free(tmp);
+  }
+  
+  std::free(raw);
+  return (bad == 0);
+#else
+  (void) row_start;
+  (void) rows;
+  (void) col_start;
+  (void) cols;
+  (void) x;
+  (void) dataset;
+  (void) h5type;
+  return false;
+#endif
+}
+
+
+
+// write the row-major rows x cols block x, with rows ldx apart, at
+// (row_start, col_start), which must start on a chunk boundary and end on one
+// or at the edge of the dataset; false if the dataset needs the library's own
+// write path
+template <typename T>
+static inline bool write_chunks(const hsize_t row_start, const hsize_t rows,
+  const hsize_t col_start, const hsize_t cols, const T *x, const hsize_t ldx,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+#if H5_VERSION_GE(1,10,2)
+  hsize_t dim_chunk[2];
+  bool shuffle;
+  int level;
+  if (rows == 0 || cols == 0 || !chunk_pipeline(dataset, h5type, dim_chunk, &shuffle, &level))
+    return false;
+  
+  hsize_t dims[2];
+  dataset->getSpace().getSimpleExtentDims(dims, NULL);
+  
+  const hsize_t cr = dim_chunk[0];
+  const hsize_t cc = dim_chunk[1];
+  const hsize_t row_end = row_start + rows;
+  const hsize_t col_end = col_start + cols;
+  if (row_start % cr != 0 || col_start % cc != 0)
+    return false;
+  if ((row_end % cr != 0 && row_end != dims[0]) || (col_end % cc != 0 && col_end != dims[1]))
+    return false;
+  
+  const hsize_t r0 = row_start / cr;
+  const hsize_t c0 = col_start / cc;
+  const hsize_t ncc = (col_end - 1)/cc - c0 + 1;
+  const hsize_t nchunks = ((row_end - 1)/cr - r0 + 1) * ncc;
+  
+  const size_t chunk_len = (size_t) (cr*cc);
+  const size_t chunk_bytes = chunk_len * sizeof(T);
+  const size_t bound = (size_t) compressBound((uLong) chunk_bytes);
+  
+  // chunks are compressed a batch at a time and then written in order
+  const hsize_t batch = std::min(nchunks, (hsize_t) std::max((size_t)1,
+    ((size_t)CHUNK_WRITE_MEM << 20) / bound));
+  
+  unsigned char *out = (unsigned char*) std::malloc(batch * bound);
+  if (out == NULL)
+    throw std::bad_alloc();
+  
+  std::vector<size_t> len(batch);
+  const hid_t ds_id = dataset->getId();
+  
+  const int nt = omp_threads(stats_in_stream());
+  for (hsize_t b=0; b<nchunks; b+=batch)
+  {
+    const hsize_t nb = std::min(batch, nchunks - b);
+    int bad = 0;
+    
+    #pragma omp parallel num_threads(nt) if(nb > 1)
+    {
+      unsigned char *tmp = (unsigned char*) std::malloc(2*chunk_bytes);
+      if (tmp == NULL)
+      {
+        #pragma omp atomic write
+        bad = 1;
+      }
+      
+      #pragma omp for schedule(dynamic)
+      for (hsize_t k=0; k<nb; k++)
+      {
+        if (tmp == NULL)
+          continue;
+        
+        // the chunk's part of the block; edge chunks are padded with zeros
+        const hsize_t i0 = (r0 + (b+k)/ncc) * cr;
+        const hsize_t j0 = (c0 + (b+k)%ncc) * cc;
+        const hsize_t ni = std::min(cr, row_end - i0);
+        const hsize_t nj = std::min(cc, col_end - j0);
+        
+        T *chunk = (T*) tmp;
+        if (ni < cr || nj < cc)
+          std::memset(tmp, 0, chunk_bytes);
+        for (hsize_t i=0; i<ni; i++)
+          std::memcpy(chunk + i*cc, x + (i0 - row_start + i)*ldx + (j0 - col_start), nj*sizeof(T));
+        
+        const unsigned char *src = tmp;
+        if (shuffle)
+        {
+          shuffle_bytes(tmp, tmp + chunk_bytes, chunk_len, sizeof(T));
+          src = tmp + chunk_bytes;
+        }
+        
+        uLongf clen = (uLongf) bound;
+        if (compress2(out + k*bound, &clen, src, (uLong) chunk_bytes, level) != Z_OK)
+        {
+          #pragma omp atomic write
+          bad = 2;
+          continue;
+        }
+        
+        len[k] = (size_t) clen;
+      }
+      
+      std::free(tmp);
+    }
+    
+    if (bad == 1)
+    {
+      std::free(out);
+      throw std::bad_alloc();
+    }
+    else if (bad == 2)
+    {
+      std::free(out);
+      return false;
+    }
+    
+    for (hsize_t k=0; k<nb; k++)
+    {
+      hsize_t offset[2];
+      offset[0] = (r0 + (b+k)/ncc) * cr;
+      offset[1] = (c0 + (b+k)%ncc) * cc;
+      
+      herr_t err;
+      H5E_BEGIN_TRY { err = H5Dwrite_chunk(ds_id, H5P_DEFAULT, 0, offset, len[k], out + k*bound); } H5E_END_TRY;
+      if (err < 0)
+      {
+        std::free(out);
+        throw std::runtime_error("unable to write a chunk");
+      }
+    }
+  }
+  
+  std::free(out);
+  return true;
+#else
+  (void) row_start;
+  (void) rows;
+  (void) col_start;
+  (void) cols;
+  (void) x;
+  (void) ldx;
+  (void) dataset;
+  (void) h5type;
+  return false;
+#endif
+}
+
+
+#endif
@@ -0,0 +1,455 @@
+#ifndef HDFMAT_COMPACT_H
+#define HDFMAT_COMPACT_H
+#pragma once
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <H5Cpp.h>
+
+#include "omp.h"
+#include "types.h"
+
+
+// Compact storage types: IEEE half precision (float16), bfloat16, and int8
+// with a float scale per row. Kernels compute on them in float; the
+// conversion happens here, in read_compact() and write_compact(), on the way
+// between the file and the panels. The raw 16- or 8-bit values are moved
+// through HDF5 without conversion and decoded by vectorizable loops, so only
+// the reduced number of bytes is read and the library's slow soft conversion
+// of non-native float formats is never used.
+//
+// The scales of an int8 matrix are a float vector in the dataset named like
+// the matrix with QSCALE_SUFFIX appended. Row i holds round(x[i, ] / s[i]) with
+// s[i] = max(abs(x[i, ])) / 127, so int8 matrices are only written whole rows
+// at a time: merging part of a row into its stored values would requantize
+// the rest of the row on every write and let the error grow with the number
+// of writes. Symmetric storage, which stores partial rows, is not supported
+// for int8. The scale dataset is opened once per matrix, on first use, and
+// closed with it by qscale_close().
+
+static inline H5::FloatType float16_type()
+{
+  H5::FloatType datatype(H5::PredType::IEEE_F32LE);
+  datatype.setFields(15, 10, 5, 0, 10);
+  datatype.setSize(2);
+  datatype.setEbias(15);
+  return datatype;
+}
+
+static inline H5::FloatType bfloat16_type()
+{
+  H5::FloatType datatype(H5::PredType::IEEE_F32LE);
+  datatype.setFields(15, 7, 8, 0, 7);
+  datatype.setSize(2);
+  datatype.setEbias(127);
+  return datatype;
+}
+
+static inline std::string qscale_name(H5::DataSet *dataset)
+{
+  return dataset->getObjName() + QSCALE_SUFFIX;
+}
+
+// the open scale datasets, by matrix; guarded like the stats table, since
+// the stream thread opens them too
+inline std::mutex& qscale_mutex()
+{
+  static std::mutex mtx;
+  return mtx;
+}
+
+inline std::unordered_map<const H5::DataSet*, H5::DataSet>& qscale_table()
+{
+  static std::unordered_map<const H5::DataSet*, H5::DataSet> table;
+  return table;
+}
+
+// the row scales of an int8 matrix, or NULL if it has none
+static inline H5::DataSet* qscale_dataset(H5::DataSet *dataset)
+{
+  std::lock_guard<std::mutex> lock(qscale_mutex());
+  auto &table = qscale_table();
+  
+  auto it = table.find(dataset);
+  if (it == table.end())
+  {
+    const std::string name = qscale_name(dataset);
+    const hid_t file_id = H5Iget_file_id(dataset->getId());
+    hid_t scale_id = -1;
+    H5E_BEGIN_TRY
+    {
+      if (H5Lexists(file_id, name.c_str(), H5P_DEFAULT) > 0)
+        scale_id = H5Dopen2(file_id, name.c_str(), H5P_DEFAULT);
+    }
+    H5E_END_TRY;
+    H5Fclose(file_id);
+    if (scale_id < 0)
+      return NULL;
+    
+    H5::DataSet scale(scale_id);
+    H5Dclose(scale_id);
+    it = table.emplace(dataset, scale).first;
+  }
+  
+  return &(it->second);
+}
+
+// Close the scales of a matrix; called when the matrix is closed or freed.
+static inline void qscale_close(const H5::DataSet *dataset)
+{
+  std::lock_guard<std::mutex> lock(qscale_mutex());
+  qscale_table().erase(dataset);
+}
+
+// the compact type of a dataset, or 0 for a float or double one; int8 needs
+// a signed 8-bit integer type and the scales next to it
+static inline int compact_type(H5::DataSet *dataset)
+{
+  H5::DataType datatype = dataset->getDataType();
+  const H5T_class_t type_class = datatype.getClass();
+  
+  if (type_class == H5T_INTEGER)
+  {
+    if (datatype.getSize() != 1 || dataset->getIntType().getSign() != H5T_SGN_2)
+      return 0;
+    return (qscale_dataset(dataset) != NULL) ? TYPE_INT8 : 0;
+  }
+  if (type_class != H5T_FLOAT || datatype.getSize() != 2)
+    return 0;
+  
+  size_t spos, epos, esize, mpos, msize;
+  dataset->getFloatType().getFields(spos, epos, esize, mpos, msize);
+  return (msize == 10) ? TYPE_FLOAT16 : TYPE_BFLOAT16;
+}
+
+
+
+// Conversions, round to nearest even, after F. Giesen's branch-light
+// versions; NaN stays NaN and values past the largest half overflow to Inf.
+static inline float float16_decode(const uint16_t h)
+{
+  const uint32_t shifted_exp = 0x7c00u << 13;
+  uint32_t u = (uint32_t) (h & 0x7fffu) << 13;
+  const uint32_t exp = shifted_exp & u;
+  
+  u += (uint32_t) (127 - 15) << 23;
+  float f;
+  if (exp == shifted_exp)
+    u += (uint32_t) (128 - 16) << 23;
+  else if (exp == 0)
+  {
+    // subnormal: renormalize through a float subtraction
+    u += 1u << 23;
+    std::memcpy(&f, &u, sizeof(f));
+    f -= 6.103515625e-05f;
+    std::memcpy(&u, &f, sizeof(u));
+  }
+  
+  u |= (uint32_t) (h & 0x8000u) << 16;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+static inline uint16_t float16_encode(const float x)
+{
+  uint32_t u;
+  std::memcpy(&u, &x, sizeof(u));
+  const uint32_t sign = u & 0x80000000u;
+  u ^= sign;
+  
+  uint16_t h;
+  if (u >= (uint32_t) (127 + 16) << 23)
+    h = (u > 0x7f800000u) ? 0x7e00 : 0x7c00;
+  else if (u < (uint32_t) 113 << 23)
+  {
+    // subnormal or zero: let a float addition do the rounding
+    const uint32_t magic_u = (uint32_t) ((127 - 15) + (23 - 10) + 1) << 23;
+    float f, magic;
+    std::memcpy(&f, &u, sizeof(f));
+    std::memcpy(&magic, &magic_u, sizeof(magic));
+    f += magic;
+    std::memcpy(&u, &f, sizeof(u));
+    h = (uint16_t) (u - magic_u);
+  }
+  else
+  {
+    const uint32_t odd = (u >> 13) & 1;
+    u += ((uint32_t) (15 - 127) << 23) + 0xfff + odd;
+    h = (uint16_t) (u >> 13);
+  }
+  
+  return h | (uint16_t) (sign >> 16);
+}
+
+static inline float bfloat16_decode(const uint16_t b)
+{
+  const uint32_t u = (uint32_t) b << 16;
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+static inline uint16_t bfloat16_encode(const float x)
+{
+  uint32_t u;
+  std::memcpy(&u, &x, sizeof(u));
+  if ((u & 0x7fffffffu) > 0x7f800000u)
+    return (uint16_t) ((u >> 16) | 0x40);
+  
+  u += 0x7fffu + ((u >> 16) & 1);
+  return (uint16_t) (u >> 16);
+}
+
+
+
+// the scales follow the int8 values in one buffer, at a float boundary
+static inline size_t qscale_offset(const hsize_t len)
+{
+  return (size_t) ((len + sizeof(float) - 1) / sizeof(float) * sizeof(float));
+}
+
+// per-row scales of rows [row_start, row_start+rows) of an int8 matrix
+static inline void qscale_io(const bool write, const hsize_t row_start,
+  const hsize_t rows, float *s, H5::DataSet *dataset)
+{
+  H5::DataSet *scale = qscale_dataset(dataset);
+  if (scale == NULL)
+    throw std::runtime_error("int8 matrix without its row scales");
+  
+  H5::DataSpace mem_space(1, &rows, NULL);
+  H5::DataSpace data_space = scale->getSpace();
+  data_space.selectHyperslab(H5S_SELECT_SET, &rows, &row_start);
+  
+  if (write)
+    scale->write(s, H5::PredType::NATIVE_FLOAT, mem_space, data_space);
+  else
+    scale->read(s, H5::PredType::NATIVE_FLOAT, mem_space, data_space);
+}
+
+// the raw rows x cols block at (row_start, col_start), in the file's type
+static inline void raw_io(const bool write, const hsize_t row_start,
+  const hsize_t rows, const hsize_t col_start, const hsize_t cols, void *x,
+  H5::DataSet *dataset)
+{
+  hsize_t slice[2];
+  slice[0] = rows;
+  slice[1] = cols;
+  
+  H5::DataSpace mem_space(2, slice, NULL);
+  H5::DataSpace data_space = dataset->getSpace();
+  
+  hsize_t offset[2];
+  offset[0] = row_start;
+  offset[1] = col_start;
+  
+  data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
+  H5::DataType datatype = dataset->getDataType();
+  if (write)
+    dataset->write(x, datatype, mem_space, data_space);
+  else
+    dataset->read(x, datatype, mem_space, data_space);
+}
+
+
+
+// read the rows x cols block at (row_start, col_start) of a compact dataset
+// into the row-major x; returns the number of bytes read from the file, or 0
+// if the dataset is not compact
+template <typename T>
+static inline double read_compact(const hsize_t row_start, const hsize_t rows,
+  const hsize_t col_start, const hsize_t cols, T *x, H5::DataSet *dataset)
+{
+  const int type = compact_type(dataset);
+  if (type == 0)
+    return 0;
+  
+  const hsize_t len = rows*cols;
+  const size_t bytes = (type == TYPE_INT8) ? qscale_offset(len) + rows*sizeof(float) : len*2;
+  void *raw = std::malloc(bytes);
+  if (raw == NULL)
+    throw std::bad_alloc();
+  
+  try
+  {
+    raw_io(false, row_start, rows, col_start, cols, raw, dataset);
+    if (type == TYPE_INT8)
+      qscale_io(false, row_start, rows, (float*) ((char*) raw + qscale_offset(len)), dataset);
+  }
+  catch (...)
+  {
+    std::free(raw);
+    throw;
+  }
+  
+  if (type == TYPE_FLOAT16)
+  {
+    const uint16_t *h = (const uint16_t*) raw;
+    #pragma omp parallel for simd if(len > OMP_MIN_LEN)
+    for (hsize_t i=0; i<len; i++)
+      x[i] = (T) float16_decode(h[i]);
+  }
+  else if (type == TYPE_BFLOAT16)
+  {
+    const uint16_t *b = (const uint16_t*) raw;
+    #pragma omp parallel for simd if(len > OMP_MIN_LEN)
+    for (hsize_t i=0; i<len; i++)
+      x[i] = (T) bfloat16_decode(b[i]);
+  }
+  else // if (type == TYPE_INT8)
+  {
+    const int8_t *q = (const int8_t*) raw;
+    const float *s = (const float*) ((char*) raw + qscale_offset(len));
+    #pragma omp parallel for if(len > OMP_MIN_LEN)
+    for (hsize_t i=0; i<rows; i++)
+    {
+      const T s_i = (T) s[i];
+      #pragma omp simd
+      for (hsize_t j=0; j<cols; j++)
+        x[j + cols*i] = s_i * (T) q[j + cols*i];
+    }
+  }
+  
+  std::free(raw);
+  return (type == TYPE_INT8) ? (double) (len + rows*sizeof(float)) : (double) bytes;
+}
+
+
+
+// quantize the full rows x n block x to int8 and scales; returns false, with
+// q and s only partly set, if x holds a NaN or an infinity, which no scale can
+// represent
+template <typename T>
+static inline bool quantize_rows(const hsize_t rows, const hsize_t n,
+  const T *x, int8_t *q, float *s)
+{
+  int bad = 0;
+  
+  #pragma omp parallel for reduction(+:bad) if(rows*n > OMP_MIN_LEN)
+  for (hsize_t i=0; i<rows; i++)
+  {
+    const T *x_i = x + n*i;
+    T mx = 0;
+    int bad_i = 0;
+    #pragma omp simd reduction(max:mx) reduction(+:bad_i)
+    for (hsize_t j=0; j<n; j++)
+    {
+      mx = std::max(mx, (T) std::fabs(x_i[j]));
+      bad_i += !std::isfinite(x_i[j]);
+    }
+    
+    if (bad_i > 0)
+    {
+      bad++;
+      continue;
+    }
+    
+    s[i] = (float) (mx / 127);
+    const T inv = (mx > 0) ? (T) 127 / mx : (T) 0;
+    #pragma omp simd
+    for (hsize_t j=0; j<n; j++)
+      q[j + n*i] = (int8_t) std::lrint(x_i[j] * inv);
+  }
+  
+  return (bad == 0);
+}
+
+// write the row-major rows x cols block x, with rows ldx apart, at
+// (row_start, col_start) of a compact dataset; returns the number of bytes
+// written to the file, or 0 if the dataset is not compact. int8 blocks must
+// be whole rows.
+template <typename T>
+static inline double write_compact(const hsize_t row_start, const hsize_t rows,
+  const hsize_t col_start, const hsize_t cols, const T *x, const hsize_t ldx,
+  H5::DataSet *dataset)
+{
+  const int type = compact_type(dataset);
+  if (type == 0)
+    return 0;
+  
+  if (type != TYPE_INT8)
+  {
+    const hsize_t len = rows*cols;
+    uint16_t *raw = (uint16_t*) std::malloc(len * sizeof(*raw));
+    if (raw == NULL)
+      throw std::bad_alloc();
+    
+    if (type == TYPE_FLOAT16)
+    {
+      #pragma omp parallel for if(len > OMP_MIN_LEN)
+      for (hsize_t i=0; i<rows; i++)
+      {
+        #pragma omp simd
+        for (hsize_t j=0; j<cols; j++)
+          raw[j + cols*i] = float16_encode((float) x[j + ldx*i]);
+      }
+    }
+    else
+    {
+      #pragma omp parallel for if(len > OMP_MIN_LEN)
+      for (hsize_t i=0; i<rows; i++)
+      {
+        #pragma omp simd
+        for (hsize_t j=0; j<cols; j++)
+          raw[j + cols*i] = bfloat16_encode((float) x[j + ldx*i]);
+      }
+    }
+    
+    try
+    {
+      raw_io(true, row_start, rows, col_start, cols, raw, dataset);
+    }
+    catch (...)
+    {
+      std::free(raw);
+      throw;
+    }
+    
+    std::free(raw);
+    return (double) (len * sizeof(*raw));
+  }
+  
+  hsize_t dims[2];
+  dataset->getSpace().getSimpleExtentDims(dims, NULL);
+  const hsize_t n = dims[1];
+  if (col_start != 0 || cols != n || ldx != n)
+    throw std::runtime_error("int8 matrices can only be written whole rows at a time");
+  
+  void *raw = std::malloc(qscale_offset(rows*n) + rows*sizeof(float));
+  if (raw == NULL)
+    throw std::bad_alloc();
+  
+  int8_t *q = (int8_t*) raw;
+  float *s = (float*) ((char*) raw + qscale_offset(rows*n));
+  if (!quantize_rows(rows, n, x, q, s))
+  {
+    std::free(raw);
+    throw std::runtime_error("int8 matrices can not hold NaN or infinite values");
+  }
+  
+  try
+  {
+    raw_io(true, row_start, rows, (hsize_t)0, n, q, dataset);
+    qscale_io(true, row_start, rows, s, dataset);
+  }
+  catch (...)
+  {
+    std::free(raw);
+    throw;
+  }
+  
+  std::free(raw);
+  return (double) (rows*n + rows*sizeof(float));
+}
+
+
+#endif
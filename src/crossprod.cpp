@@ -1,5 +1,5 @@
+#include <algorithm>
 #include <cstdlib>
-#include <cstring>
 
 #include <float/float32.h>
 
@@ -8,113 +8,292 @@
 #include "hdfmat.h"
 #include "extptr.h"
 #include "omp.h"
+#include "panel.hh"
 #include "types.h"
 
 
+// Copy the upper triangle of the column-major b x b block x (leading dimension
+// ld) into its lower triangle.
 template <typename T>
-static inline void cp(const int m, const int n, const T *x,
-  H5::DataSet *dataset, H5::PredType h5type)
+static inline void mirror_upper(const int b, T *x, const int ld)
+{
+  for (int j=0; j<b; j++)
+  {
+    for (int i=0; i<j; i++)
+      x[j + (size_t)ld*i] = x[i + (size_t)ld*j];
+  }
+}
+
+
+
+// The result is built a band of rows at a time with a few level-3 BLAS calls
+// and each band is written in one go, in the background while the next one is
+// computed. A row-major band is the column-major transpose, so the band of
+// crossprod(x) over rows [i, i+b) is t(x)*x[, i:(i+b)] as a column-major
+// n x b matrix. With symmetric storage only columns [i, n) are formed: syrk
+// on the diagonal block and gemm on the rest.
+template <typename T>
+static inline void cp(const int m, const int n, const T *x, const double mem,
+  const int storage, H5::DataSet *dataset, H5::PredType h5type)
 {
-  T *y = (T*) std::malloc(m * sizeof(*y));
-  T *cp_row = (T*) std::malloc(n * sizeof(*cp_row));
+  const hsize_t nr = panel_rows_stored(n, n, sizeof(T), mem/2, storage, dataset);
   
-  hsize_t slice[2];
-  slice[0] = (hsize_t) 1;
-  slice[1] = (hsize_t) n;
+  panel_stream<T> s(n, nr, n, nullptr,
+    [&](hsize_t i, hsize_t rows, const T *band) {
+      write_panel_stored(i, rows, (hsize_t)n, band, storage, dataset, h5type);
+    }
+  );
   
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
+  for (int i=0; i<n; i+=nr)
+  {
+    const int b = std::min((int)nr, n-i);
+    const T *x_i = x + (size_t)m*i;
+    T *band = s.next();
+    
+    if (storage == STORAGE_SYM)
+    {
+      const int w = n - i;
+      fml::blas::syrk('U', 'T', b, m, (T)1, x_i, m, (T)0, band, w);
+      mirror_upper(b, band, w);
+      if (w > b)
+        fml::blas::gemm('T', 'N', w-b, b, m, (T)1, x_i + (size_t)m*b, m, x_i, m, (T)0, band+b, w);
+    }
+    else
+      fml::blas::gemm('T', 'N', n, b, m, (T)1, x, m, x_i, m, (T)0, band, n);
+  }
   
-  hsize_t offset[2];
-  offset[1] = 0;
+  s.finish();
+}
+
+extern "C" SEXP R_hdfmat_cp(SEXP x, SEXP ds, SEXP type, SEXP storage,
+  SEXP mem_)
+{
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
-  for (int i=0; i<n; i++)
+  const int m = nrows(x);
+  const int n = ncols(x);
+  const double mem = DBL(mem_);
+  
+  if (INT(type) == TYPE_DOUBLE)
   {
-    std::memcpy(y, x+i*m, m*sizeof(T));
-    fml::blas::gemm('T', 'N', n, 1, m, (T)1, x, m, y, m, (T)0, cp_row, n);
-    
-    offset[0] = (hsize_t) i;
-    data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
+    TRY_CATCH( cp(m, n, REAL(x), mem, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
+  }
+    else // if (INT(type) == TYPE_FLOAT)
+  {
+    TRY_CATCH( cp(m, n, FLOAT(x), mem, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
+  }
+  
+  stats_end(st);
+  return R_NilValue;
+}
+
+
+
+
+// Same banding as cp(); the band of tcrossprod(x) over rows [i, i+b) is
+// x*t(x[i:(i+b), ]) as a column-major m x b matrix.
+template <typename T>
+static inline void tcp(const int m, const int n, const T *x, const double mem,
+  const int storage, H5::DataSet *dataset, H5::PredType h5type)
+{
+  const hsize_t nr = panel_rows_stored(m, m, sizeof(T), mem/2, storage, dataset);
+  
+  panel_stream<T> s(m, nr, m, nullptr,
+    [&](hsize_t i, hsize_t rows, const T *band) {
+      write_panel_stored(i, rows, (hsize_t)m, band, storage, dataset, h5type);
+    }
+  );
+  
+  for (int i=0; i<m; i+=nr)
+  {
+    const int b = std::min((int)nr, m-i);
+    T *band = s.next();
     
-    dataset->write(cp_row, h5type, mem_space, data_space);
+    if (storage == STORAGE_SYM)
+    {
+      const int w = m - i;
+      fml::blas::syrk('U', 'N', b, n, (T)1, x+i, m, (T)0, band, w);
+      mirror_upper(b, band, w);
+      if (w > b)
+        fml::blas::gemm('N', 'T', w-b, b, n, (T)1, x+i+b, m, x+i, m, (T)0, band+b, w);
+    }
+    else
+      fml::blas::gemm('N', 'T', m, b, n, (T)1, x, m, x+i, m, (T)0, band, m);
   }
   
-  std::free(y);
-  std::free(cp_row);
+  s.finish();
 }
 
-extern "C" SEXP R_hdfmat_cp(SEXP x, SEXP ds, SEXP type)
+extern "C" SEXP R_hdfmat_tcp(SEXP x, SEXP ds, SEXP type, SEXP storage,
+  SEXP mem_)
 {
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const int m = nrows(x);
   const int n = ncols(x);
+  const double mem = DBL(mem_);
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    TRY_CATCH( cp(m, n, REAL(x), dataset, H5::PredType::IEEE_F64LE) );
+    TRY_CATCH( tcp(m, n, REAL(x), mem, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
   }
     else // if (INT(type) == TYPE_FLOAT)
   {
-    TRY_CATCH( cp(m, n, FLOAT(x), dataset, H5::PredType::IEEE_F32LE) );
+    TRY_CATCH( tcp(m, n, FLOAT(x), mem, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
   }
   
+  stats_end(st);
   return R_NilValue;
 }
 
 
 
 
+// Crossproducts of an m x n hdfmat X. Half of the memory budget goes to the
+// band of result rows and half to the (double-buffered) panels of X rows
+// streamed through it, so X is read once per band; once if the whole result
+// fits. A row-major panel of X is the column-major n x rows matrix t(P), and
+// the band over rows [i, i+b) accumulates t(P)*t(P[, i:(i+b)]) panel by
+// panel.
 template <typename T>
-static inline void tcp(const int m, const int n, const T *x,
+static inline void cp_ooc(const hsize_t m, const hsize_t n, const double mem,
+  const int storage_x, H5::DataSet *dataset_x, const int storage,
   H5::DataSet *dataset, H5::PredType h5type)
 {
-  T *y = (T*) std::malloc(n * sizeof(*y));
-  T *tcp_row = (T*) std::malloc(m * sizeof(*tcp_row));
+  const hsize_t nb = panel_rows_stored(n, n, sizeof(T), mem/2, storage, dataset);
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), mem/4, storage_x, dataset_x);
+  
+  T *band = panel_alloc<T>(nb, n);
+  const dataset_map map(dataset_x, h5type);
   
-  hsize_t slice[2];
-  slice[0] = (hsize_t) 1;
-  slice[1] = (hsize_t) m;
+  for (hsize_t i=0; i<n; i+=nb)
+  {
+    const int b = (int) std::min(nb, n-i);
+    const int w = (int) (n - stored_col_start(i, storage));
+    
+    panel_stream<T> s(m, nr, n, [&](hsize_t j, hsize_t rows, T *x) {
+      read_rows(j, rows, n, x, storage_x, dataset_x, h5type);
+    }, map);
+    
+    for (hsize_t j=0; j<m; j+=nr)
+    {
+      const int rows = (int) std::min(nr, m-j);
+      const T *P = s.next();
+      const T *P_i = P + i;
+      
+      const T beta = (j == 0) ? (T)0 : (T)1;
+      if (storage == STORAGE_SYM)
+      {
+        fml::blas::syrk('U', 'N', b, rows, (T)1, P_i, n, beta, band, w);
+        if (w > b)
+          fml::blas::gemm('N', 'T', w-b, b, rows, (T)1, P_i+b, n, P_i, n, beta, band+b, w);
+      }
+      else
+        fml::blas::gemm('N', 'T', n, b, rows, (T)1, P, n, P_i, n, beta, band, n);
+    }
+    
+    s.finish();
+    
+    if (storage == STORAGE_SYM)
+      mirror_upper(b, band, w);
+    
+    write_panel_stored(i, (hsize_t)b, n, band, storage, dataset, h5type);
+  }
   
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
+  std::free(band);
+}
+
+extern "C" SEXP R_hdfmat_cp_ooc(SEXP m_, SEXP n_, SEXP ds_x, SEXP storage_x,
+  SEXP ds, SEXP type, SEXP storage, SEXP mem_)
+{
+  H5::DataSet *dataset_x = (H5::DataSet*) getRptr(ds_x);
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
-  hsize_t offset[2];
-  offset[1] = 0;
+  const hsize_t m = (hsize_t) DBL(m_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const double mem = DBL(mem_);
   
-  for (int i=0; i<m; i++)
+  if (INT(type) == TYPE_DOUBLE)
+  {
+    TRY_CATCH( cp_ooc<double>(m, n, mem, INT(storage_x), dataset_x, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
+  }
+  else // if (INT(type) == TYPE_FLOAT)
   {
-    #pragma omp for simd
-    for (int j=0; j<n; j++)
-      y[j] = x[i + j*m];
+    TRY_CATCH( cp_ooc<float>(m, n, mem, INT(storage_x), dataset_x, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
+  }
+  
+  stats_end(st);
+  return R_NilValue;
+}
+
+
+
+
+// The band of tcrossprod(X) over rows [i, i+b) is t(P)*t(X[i:(i+b), ]) for
+// each panel P of rows of X, so every element is formed exactly once. The
+// budget is split between the band (its X rows and its result rows) and the
+// streamed panels. Symmetric storage skips the panels left of the band.
+template <typename T>
+static inline void tcp_ooc(const hsize_t m, const hsize_t n, const double mem,
+  const int storage_x, H5::DataSet *dataset_x, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  const hsize_t nb = panel_rows_stored(m, m+n, sizeof(T), mem/2, storage, dataset);
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), mem/4, storage_x, dataset_x);
+  
+  T *X_i = panel_alloc<T>(nb, n);
+  T *band = panel_alloc<T>(nb, m);
+  
+  for (hsize_t i=0; i<m; i+=nb)
+  {
+    const int b = (int) std::min(nb, m-i);
+    const hsize_t c = stored_col_start(i, storage);
+    const int w = (int) (m - c);
     
-    fml::blas::gemm('N', 'T', 1, m, n, (T)1, y, 1, x, m, (T)0, tcp_row, 1);
+    read_rows(i, (hsize_t)b, n, X_i, storage_x, dataset_x, h5type);
     
-    offset[0] = (hsize_t) i;
-    data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
+    panel_stream<T> s(m, nr, n, [&](hsize_t j, hsize_t rows, T *x) {
+      read_rows(j, rows, n, x, storage_x, dataset_x, h5type);
+    }, nullptr, c);
     
-    dataset->write(tcp_row, h5type, mem_space, data_space);
+    for (hsize_t j=c; j<m; j+=nr)
+    {
+      const int rows = (int) std::min(nr, m-j);
+      const T *P = s.next();
+      fml::blas::gemm('T', 'N', rows, b, n, (T)1, P, n, X_i, n, (T)0, band+(j-c), w);
+    }
+    
+    s.finish();
+    write_panel_stored(i, (hsize_t)b, m, band, storage, dataset, h5type);
   }
   
-  std::free(y);
-  std::free(tcp_row);
+  std::free(X_i);
+  std::free(band);
 }
 
-extern "C" SEXP R_hdfmat_tcp(SEXP x, SEXP ds, SEXP type)
+extern "C" SEXP R_hdfmat_tcp_ooc(SEXP m_, SEXP n_, SEXP ds_x, SEXP storage_x,
+  SEXP ds, SEXP type, SEXP storage, SEXP mem_)
 {
+  H5::DataSet *dataset_x = (H5::DataSet*) getRptr(ds_x);
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
-  const int m = nrows(x);
-  const int n = ncols(x);
+  const hsize_t m = (hsize_t) DBL(m_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const double mem = DBL(mem_);
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    TRY_CATCH( tcp(m, n, REAL(x), dataset, H5::PredType::IEEE_F64LE) );
+    TRY_CATCH( tcp_ooc<double>(m, n, mem, INT(storage_x), dataset_x, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
   }
-    else // if (INT(type) == TYPE_FLOAT)
+  else // if (INT(type) == TYPE_FLOAT)
   {
-    TRY_CATCH( tcp(m, n, FLOAT(x), dataset, H5::PredType::IEEE_F32LE) );
+    TRY_CATCH( tcp_ooc<float>(m, n, mem, INT(storage_x), dataset_x, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
   }
   
+  stats_end(st);
   return R_NilValue;
 }
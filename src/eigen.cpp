@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
 #include "lanczos.hh"
 #include "omp.h"
+#include "panel.hh"
 
 #include <fml/src/fml/cpu/cpumat.hh>
 #include <fml/src/fml/cpu/cpuvec.hh>
@@ -10,34 +15,18 @@
 #include "types.h"
 
 
-template <typename T>
+// The file holds S; the recurrence runs in T (see panel_matmult()).
+template <typename T, typename S=T>
 static inline void lanczos(const hsize_t n, const int k,
-  T *alpha, T *beta, T *q, H5::DataSet *dataset, H5::PredType h5type)
+  T *alpha, T *beta, T *q, const double mem, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
 {
-  T *A_j = (T*) std::malloc(n * sizeof(*A_j));
   T *v = (T*) std::malloc(n * sizeof(*v));
   
-  hsize_t slice[2];
-  slice[0] = 1;
-  slice[1] = n;
-  
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
-  
-  hsize_t offset[2];
-  offset[1] = 0;
-  
   for (int i=0; i<k; i++)
   {
-    // v = A*q[, i] iterate over *row j* of A - A_j is 1xn
-    for (hsize_t j=0; j<n; j++)
-    {
-      offset[0] = j;
-      data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-      dataset->read(A_j, h5type, mem_space, data_space);
-      
-      v[j] = dot(n, A_j, q+n*i);
-    }
+    // v = A*q[, i] iterate over *row panels* of A
+    panel_matmult<T, S>(n, n, 1, q+n*i, v, mem, storage, dataset, h5type);
     
     alpha[i] = dot(n, q+n*i, v);
     
@@ -70,21 +59,109 @@ static inline void lanczos(const hsize_t n, const int k,
     }
   }
   
-  std::free(A_j);
   std::free(v);
 }
 
 
 
-template <typename T>
+// block Lanczos with s steps of block size b; each step is one pass over A.
+// td is the (s*b) x (s*b) block tridiagonal matrix.
+template <typename T, typename S=T>
+static inline void block_lanczos(const hsize_t n, const int b, const int s,
+  T *td, const uint64_t seed, const double mem, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  const int kb = s*b;
+  T *Q = (T*) std::malloc(n*b * sizeof(*Q));
+  T *Q_prev = (T*) std::malloc(n*b * sizeof(*Q_prev));
+  T *W = (T*) std::malloc(n*b * sizeof(*W));
+  T *A_j = (T*) std::malloc(b*b * sizeof(*A_j));
+  T *B_j = (T*) std::malloc(b*b * sizeof(*B_j));
+  
+  initialize_block(n, b, W, seed);
+  orthonormalize(n, b, W, Q, (T*)NULL);
+  
+  std::memset(td, 0, kb*kb*sizeof(*td));
+  
+  for (int j=0; j<s; j++)
+  {
+    // W = A*Q_j
+    panel_matmult<T, S>(n, n, b, Q, W, mem, storage, dataset, h5type);
+    
+    // A_j = t(Q_j)*W
+    fml::blas::gemm('T', 'N', b, b, n, (T)1, Q, n, W, n, (T)0, A_j, b);
+    
+    // W = W - Q_j*A_j - Q_{j-1}*t(B_{j-1})
+    fml::blas::gemm('N', 'N', n, b, b, (T)-1, Q, n, A_j, b, (T)1, W, n);
+    if (j > 0)
+      fml::blas::gemm('N', 'T', n, b, b, (T)-1, Q_prev, n, B_j, b, (T)1, W, n);
+    
+    for (int c=0; c<b; c++)
+    {
+      for (int r=0; r<b; r++)
+        td[(j*b + r) + kb*(j*b + c)] = A_j[r + b*c];
+    }
+    
+    if (j < s-1)
+    {
+      // W = Q_{j+1}*B_j
+      std::swap(Q, Q_prev);
+      orthonormalize(n, b, W, Q, B_j);
+      
+      for (int c=0; c<b; c++)
+      {
+        for (int r=0; r<b; r++)
+        {
+          td[((j+1)*b + r) + kb*(j*b + c)] = B_j[r + b*c];
+          td[(j*b + c) + kb*((j+1)*b + r)] = B_j[r + b*c];
+        }
+      }
+    }
+  }
+  
+  std::free(Q);
+  std::free(Q_prev);
+  std::free(W);
+  std::free(A_j);
+  std::free(B_j);
+}
+
+
+
+template <typename T, typename S=T>
+static inline void eigen_sym_block(const hsize_t n, const int k, const int b,
+  T *values, const uint64_t seed, const double mem, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  const int s = (k + b - 1) / b;
+  const int kb = s*b;
+  
+  T *td = (T *) std::malloc(kb*kb * sizeof(*td));
+  block_lanczos<T, S>(n, b, s, td, seed, mem, storage, dataset, h5type);
+  
+  fml::cpumat<T> td_mat(td, kb, kb, false);
+  fml::cpuvec<T> values_vec(kb);
+  fml::linalg::eigen_sym(td_mat, values_vec);
+  std::free(td);
+  
+  values_vec.rev();
+  const T *values_kb = values_vec.data_ptr();
+  for (int i=0; i<k; i++)
+    values[i] = values_kb[i] < 0 ? 0 : values_kb[i];
+}
+
+
+
+template <typename T, typename S=T>
 static inline void eigen_sym(const hsize_t n, const int k,
-  T *values, H5::DataSet *dataset, H5::PredType h5type)
+  T *values, const uint64_t seed, const double mem, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
 {
   T *alpha, *beta, *q;
   alloc(n, k, &alpha, &beta, &q);
-  initialize(n, k, q);
+  initialize(n, k, q, seed);
   
-  lanczos(n, k, alpha, beta, q, dataset, h5type);
+  lanczos<T, S>(n, k, alpha, beta, q, mem, storage, dataset, h5type);
   std::free(q);
   
   T *td = (T *) std::malloc(k*k * sizeof(*td));
@@ -107,25 +184,61 @@ static inline void eigen_sym(const hsize_t n, const int k,
 
 
 
-extern "C" SEXP R_hdfmat_eigen_sym(SEXP k_, SEXP n_, SEXP ds, SEXP type)
+// With mixed set, float data is read as float and the Lanczos vectors and
+// values are double.
+extern "C" SEXP R_hdfmat_eigen_sym(SEXP k_, SEXP n_, SEXP ds, SEXP type,
+  SEXP storage_, SEXP mem_, SEXP block_, SEXP seed_, SEXP mixed_)
 {
   SEXP values;
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const int k = INT(k_);
   const hsize_t n = (hsize_t) DBL(n_);
+  const int storage = INT(storage_);
+  const double mem = DBL(mem_);
+  const int block = INT(block_);
+  const uint64_t seed = (uint64_t) DBL(seed_);
+  const bool mixed = (bool) LOGICAL(mixed_)[0];
   
   if (INT(type) == TYPE_DOUBLE)
   {
     PROTECT(values = allocVector(REALSXP, k));
-    TRY_CATCH( eigen_sym(n, k, REAL(values), dataset, H5::PredType::IEEE_F64LE) );
+    if (block == 1)
+    {
+      TRY_CATCH( eigen_sym(n, k, REAL(values), seed, mem, storage, dataset, H5::PredType::IEEE_F64LE) );
+    }
+    else
+    {
+      TRY_CATCH( eigen_sym_block(n, k, block, REAL(values), seed, mem, storage, dataset, H5::PredType::IEEE_F64LE) );
+    }
+  }
+  else if (mixed)
+  {
+    PROTECT(values = allocVector(REALSXP, k));
+    if (block == 1)
+    {
+      TRY_CATCH( (eigen_sym<double, float>(n, k, REAL(values), seed, mem, storage, dataset, H5::PredType::IEEE_F32LE)) );
+    }
+    else
+    {
+      TRY_CATCH( (eigen_sym_block<double, float>(n, k, block, REAL(values), seed, mem, storage, dataset, H5::PredType::IEEE_F32LE)) );
+    }
   }
   else // if (INT(type) == TYPE_FLOAT)
   {
     PROTECT(values = allocVector(INTSXP, k));
-    TRY_CATCH( eigen_sym(n, k, FLOAT(values), dataset, H5::PredType::IEEE_F32LE) );
+    if (block == 1)
+    {
+      TRY_CATCH( eigen_sym(n, k, FLOAT(values), seed, mem, storage, dataset, H5::PredType::IEEE_F32LE) );
+    }
+    else
+    {
+      TRY_CATCH( eigen_sym_block(n, k, block, FLOAT(values), seed, mem, storage, dataset, H5::PredType::IEEE_F32LE) );
+    }
   }
   
+  stats_end(st);
   UNPROTECT(1);
   return values;
 }
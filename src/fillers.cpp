@@ -1,45 +1,48 @@
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 
 #include "hdfmat.h"
 #include "extptr.h"
 #include "omp.h"
+#include "panel.hh"
+#include "rng.hh"
 #include "types.h"
 
 
+// side of the tiles of the structured fills of unchunked datasets
+#define FILL_TILE 512
+
+
 template <typename T>
 static inline void fill_val(const T v, const hsize_t m, const hsize_t n,
-  H5::DataSet *dataset, H5::PredType h5type)
+  const int storage, H5::DataSet *dataset, H5::PredType h5type)
 {
-  T *x = (T*) std::malloc(n * sizeof(*x));
-  
-  #pragma omp for simd
-  for (hsize_t j=0; j<n; j++)
-    x[j] = v;
-  
-  hsize_t slice[2];
-  slice[0] = 1;
-  slice[1] = n;
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), STREAM_MEM/2, storage, dataset);
   
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
+  panel_stream<T> s(m, nr, n, nullptr,
+    [&](hsize_t i, hsize_t rows, const T *x) {
+      write_panel_stored(i, rows, n, x, storage, dataset, h5type);
+    }
+  );
   
-  hsize_t offset[2];
-  offset[1] = 0;
-  
-  for (hsize_t i=0; i<m; i++)
+  for (hsize_t i=0; i<m; i+=nr)
   {
-    offset[0] = i;
+    const hsize_t len = std::min(nr, m-i) * (n - stored_col_start(i, storage));
+    T *x = s.next();
     
-    data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-    dataset->write(x, h5type, mem_space, data_space);
+    #pragma omp for simd
+    for (hsize_t j=0; j<len; j++)
+      x[j] = v;
   }
   
-  std::free(x);
+  s.finish();
 }
 
-extern "C" SEXP R_hdfmat_fill_val(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP type)
+extern "C" SEXP R_hdfmat_fill_val(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP type, SEXP storage)
 {
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const hsize_t m = (hsize_t) REAL(m_)[0];
   const hsize_t n = (hsize_t) REAL(n_)[0];
@@ -47,13 +50,14 @@ extern "C" SEXP R_hdfmat_fill_val(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP typ
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    TRY_CATCH( fill_val(v, m, n, dataset, H5::PredType::IEEE_F64LE) );
+    TRY_CATCH( fill_val(v, m, n, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
   }
   else // if (INT(type) == TYPE_FLOAT)
   {
-    TRY_CATCH( fill_val((float)v, m, n, dataset, H5::PredType::IEEE_F32LE) );
+    TRY_CATCH( fill_val((float)v, m, n, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
   }
   
+  stats_end(st);
   return R_NilValue;
 }
 
@@ -63,38 +67,36 @@ template <typename T>
 static inline void fill_linspace(const T start, const T stop, const hsize_t m,
   const hsize_t n, H5::DataSet *dataset, H5::PredType h5type)
 {
-  T *x = (T*) std::malloc(n * sizeof(*x));
-  
-  hsize_t slice[2];
-  slice[0] = 1;
-  slice[1] = n;
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), STREAM_MEM/2, STORAGE_FULL, dataset);
   
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
-  
-  hsize_t offset[2];
-  offset[1] = 0;
+  panel_stream<T> s(m, nr, n, nullptr,
+    [&](hsize_t i, hsize_t rows, const T *x) {
+      write_panel(i, rows, (hsize_t)0, n, x, dataset, h5type);
+    }
+  );
   
   const T v = (stop-start)/((T) (m*n - 1));
   
-  for (hsize_t i=0; i<m; i++)
+  for (hsize_t i=0; i<m; i+=nr)
   {
-    offset[0] = i;
-    
-    #pragma omp for simd
-    for (hsize_t j=0; j<n; j++)
-      x[j] = v * ((T) i + m*j) + start;
+    const hsize_t rows = std::min(nr, m-i);
+    T *x = s.next();
     
-    data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-    dataset->write(x, h5type, mem_space, data_space);
+    for (hsize_t r=0; r<rows; r++)
+    {
+      #pragma omp for simd
+      for (hsize_t j=0; j<n; j++)
+        x[j + n*r] = v * ((T) (i+r) + m*j) + start;
+    }
   }
   
-  std::free(x);
+  s.finish();
 }
 
 extern "C" SEXP R_hdfmat_fill_linspace(SEXP m_, SEXP n_, SEXP ds, SEXP start_, SEXP stop_, SEXP type)
 {
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const hsize_t m = (hsize_t) REAL(m_)[0];
   const hsize_t n = (hsize_t) REAL(n_)[0];
@@ -111,164 +113,219 @@ extern "C" SEXP R_hdfmat_fill_linspace(SEXP m_, SEXP n_, SEXP ds, SEXP start_, S
     TRY_CATCH( fill_linspace((float)start, (float)stop, m, n, dataset, H5::PredType::IEEE_F32LE) );
   }
   
+  stats_end(st);
   return R_NilValue;
 }
 
 
 
+// Element (i, j) is value number i*n + j of the generator, so the result
+// depends only on the seed and not on the panel size or the number of threads.
 template <typename T>
-static inline void fill_runif(const T min, const T max, const hsize_t m,
-  const hsize_t n, H5::DataSet *dataset, H5::PredType h5type)
+static inline void fill_runif(const T min, const T max, const uint64_t seed,
+  const hsize_t m, const hsize_t n, H5::DataSet *dataset, H5::PredType h5type)
 {
-  T *x = (T*) std::malloc(n * sizeof(*x));
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), STREAM_MEM/2, STORAGE_FULL, dataset);
   
-  hsize_t slice[2];
-  slice[0] = 1;
-  slice[1] = n;
+  panel_stream<T> s(m, nr, n, nullptr,
+    [&](hsize_t i, hsize_t rows, const T *x) {
+      write_panel(i, rows, (hsize_t)0, n, x, dataset, h5type);
+    }
+  );
   
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
-  
-  hsize_t offset[2];
-  offset[1] = 0;
-  
-  GetRNGstate();
-  
-  for (hsize_t i=0; i<m; i++)
+  for (hsize_t i=0; i<m; i+=nr)
   {
-    offset[0] = i;
-    
-    for (hsize_t j=0; j<n; j++)
-      x[j] = (T) min + (max - min)*((T)unif_rand());
+    const hsize_t len = std::min(nr, m-i) * n;
+    T *x = s.next();
     
-    data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-    dataset->write(x, h5type, mem_space, data_space);
+    #pragma omp parallel for simd if(len > OMP_MIN_LEN)
+    for (hsize_t j=0; j<len; j++)
+      x[j] = min + (max - min)*((T)rng_unif(seed, RNG_STREAM_FILL, i*n + j));
   }
   
-  PutRNGstate();
-  
-  std::free(x);
+  s.finish();
 }
 
-extern "C" SEXP R_hdfmat_fill_runif(SEXP m_, SEXP n_, SEXP ds, SEXP min_, SEXP max_, SEXP type)
+extern "C" SEXP R_hdfmat_fill_runif(SEXP m_, SEXP n_, SEXP ds, SEXP min_, SEXP max_, SEXP seed_, SEXP type)
 {
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const hsize_t m = (hsize_t) REAL(m_)[0];
   const hsize_t n = (hsize_t) REAL(n_)[0];
   
   const double min = DBL(min_);
   const double max = DBL(max_);
+  const uint64_t seed = (uint64_t) DBL(seed_);
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    TRY_CATCH( fill_runif(min, max, m, n, dataset, H5::PredType::IEEE_F64LE) );
+    TRY_CATCH( fill_runif(min, max, seed, m, n, dataset, H5::PredType::IEEE_F64LE) );
   }
     else // if (INT(type) == TYPE_FLOAT)
   {
-    TRY_CATCH( fill_runif((float)min, (float)max, m, n, dataset, H5::PredType::IEEE_F32LE) );
+    TRY_CATCH( fill_runif((float)min, (float)max, seed, m, n, dataset, H5::PredType::IEEE_F32LE) );
   }
   
+  stats_end(st);
   return R_NilValue;
 }
 
 
 
 template <typename T>
-static inline void fill_rnorm(const T mean, const T sd, const hsize_t m,
-  const hsize_t n, H5::DataSet *dataset, H5::PredType h5type)
+static inline void fill_rnorm(const T mean, const T sd, const uint64_t seed,
+  const hsize_t m, const hsize_t n, H5::DataSet *dataset, H5::PredType h5type)
 {
-  T *x = (T*) std::malloc(n * sizeof(*x));
-  
-  hsize_t slice[2];
-  slice[0] = 1;
-  slice[1] = n;
-  
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), STREAM_MEM/2, STORAGE_FULL, dataset);
   
-  hsize_t offset[2];
-  offset[1] = 0;
+  panel_stream<T> s(m, nr, n, nullptr,
+    [&](hsize_t i, hsize_t rows, const T *x) {
+      write_panel(i, rows, (hsize_t)0, n, x, dataset, h5type);
+    }
+  );
   
-  GetRNGstate();
-  
-  for (hsize_t i=0; i<m; i++)
+  for (hsize_t i=0; i<m; i+=nr)
   {
-    offset[0] = i;
-    
-    for (hsize_t j=0; j<n; j++)
-      x[j] = mean + sd*((T)norm_rand());
+    const hsize_t len = std::min(nr, m-i) * n;
+    T *x = s.next();
     
-    data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-    dataset->write(x, h5type, mem_space, data_space);
+    #pragma omp parallel for simd if(len > OMP_MIN_LEN)
+    for (hsize_t j=0; j<len; j++)
+      x[j] = mean + sd*((T)rng_norm(seed, RNG_STREAM_FILL, i*n + j));
   }
   
-  PutRNGstate();
-  
-  std::free(x);
+  s.finish();
 }
 
-extern "C" SEXP R_hdfmat_fill_rnorm(SEXP m_, SEXP n_, SEXP ds, SEXP mean_, SEXP sd_, SEXP type)
+extern "C" SEXP R_hdfmat_fill_rnorm(SEXP m_, SEXP n_, SEXP ds, SEXP mean_, SEXP sd_, SEXP seed_, SEXP type)
 {
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const hsize_t m = (hsize_t) REAL(m_)[0];
   const hsize_t n = (hsize_t) REAL(n_)[0];
   
   const double mean = DBL(mean_);
   const double sd = DBL(sd_);
+  const uint64_t seed = (uint64_t) DBL(seed_);
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    TRY_CATCH( fill_rnorm(mean, sd, m, n, dataset, H5::PredType::IEEE_F64LE) );
+    TRY_CATCH( fill_rnorm(mean, sd, seed, m, n, dataset, H5::PredType::IEEE_F64LE) );
   }
     else // if (INT(type) == TYPE_FLOAT)
   {
-    TRY_CATCH( fill_rnorm((float)mean, (float)sd, m, n, dataset, H5::PredType::IEEE_F32LE) );
+    TRY_CATCH( fill_rnorm((float)mean, (float)sd, seed, m, n, dataset, H5::PredType::IEEE_F32LE) );
   }
   
+  stats_end(st);
   return R_NilValue;
 }
 
 
 
-template <typename T>
-static inline void fill_diag(const int vlen, const T *v, const hsize_t m,
-  const hsize_t n, H5::DataSet *dataset, H5::PredType h5type)
+// Tile shape for the structured fills: the chunks of a chunked dataset, so
+// each chunk is touched at most once, or FILL_TILE square blocks otherwise.
+// int8 matrices are written whole rows at a time, so their tiles are as many
+// full rows as there are elements in a chunk.
+static inline void fill_tile(H5::DataSet *dataset, hsize_t dim_tile[2])
 {
-  const hsize_t len = m<n?m:n;
-  
-  hsize_t slice[2];
-  slice[0] = 1;
-  slice[1] = 1;
+  H5::DSetCreatPropList plist = dataset->getCreatePlist();
+  if (plist.getLayout() == H5D_CHUNKED)
+    plist.getChunk(2, dim_tile);
+  else
+    dim_tile[0] = dim_tile[1] = FILL_TILE;
   
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
+  if (compact_type(dataset) == TYPE_INT8)
+  {
+    hsize_t dims[2];
+    dataset->getSpace().getSimpleExtentDims(dims, NULL);
+    dim_tile[0] = std::max((hsize_t)1, dim_tile[0]*dim_tile[1] / dims[1]);
+    dim_tile[1] = dims[1];
+  }
+}
+
+
+
+// Set the elements (i, j) with first <= j - i <= last to v[i % vlen] and leave
+// the rest alone, one tile at a time. Tiles that miss the band are skipped,
+// tiles inside it are written without being read, and only the tiles it cuts
+// through are read, updated, and written back; each takes one HDF5 read and
+// one write. Symmetric storage skips the unstored tiles below the diagonal
+// (the band is symmetric there).
+template <typename T>
+static inline void fill_band(const int vlen, const T *v, const double first,
+  const double last, const hsize_t m, const hsize_t n, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  hsize_t dim_tile[2];
+  fill_tile(dataset, dim_tile);
+  const hsize_t tr = dim_tile[0];
+  const hsize_t tc = dim_tile[1];
   
-  hsize_t offset[2];
+  T *x = panel_alloc<T>(tr, tc);
   
-  for (hsize_t i=0; i<len; i++)
+  for (hsize_t r0=0; r0<m; r0+=tr)
   {
-    offset[0] = i;
-    offset[1] = i;
-    data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
+    const hsize_t rows = std::min(tr, m-r0);
+    
+    // columns of the band in these rows
+    const double lo = std::max(0.0, (double)r0 + first);
+    const double hi = std::min((double)n - 1, (double)(r0+rows-1) + last);
+    if (lo > hi)
+      continue;
+    
+    hsize_t c_start = (hsize_t)lo / tc * tc;
+    if (storage == STORAGE_SYM)
+      c_start = std::max(c_start, r0);
     
-    dataset->write(v+(i % vlen), h5type, mem_space, data_space);
+    for (hsize_t c0=c_start; c0<=(hsize_t)hi; c0+=tc)
+    {
+      const hsize_t cols = std::min(tc, n-c0);
+      
+      // range of j - i over the tile
+      const double d_min = (double)c0 - (double)(r0+rows-1);
+      const double d_max = (double)(c0+cols-1) - (double)r0;
+      const bool inside = (d_min >= first && d_max <= last);
+      
+      if (!inside)
+        read_panel(r0, rows, c0, cols, x, dataset, h5type);
+      
+      for (hsize_t i=0; i<rows; i++)
+      {
+        const T val = v[(r0+i) % vlen];
+        for (hsize_t j=0; j<cols; j++)
+        {
+          const double d = (double)(c0+j) - (double)(r0+i);
+          if (d >= first && d <= last)
+            x[j + cols*i] = val;
+        }
+      }
+      
+      write_panel(r0, rows, c0, cols, x, dataset, h5type);
+    }
   }
+  
+  std::free(x);
 }
 
-extern "C" SEXP R_hdfmat_fill_diag(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP type)
+extern "C" SEXP R_hdfmat_fill_band(SEXP m_, SEXP n_, SEXP ds, SEXP val_,
+  SEXP first_, SEXP last_, SEXP type, SEXP storage)
 {
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const hsize_t m = (hsize_t) REAL(m_)[0];
   const hsize_t n = (hsize_t) REAL(n_)[0];
   const int vlen = LENGTH(val_);
   const double *v = REAL(val_);
+  const double first = DBL(first_);
+  const double last = DBL(last_);
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    TRY_CATCH( fill_diag(vlen, v, m, n, dataset, H5::PredType::IEEE_F64LE) );
+    TRY_CATCH( fill_band(vlen, v, first, last, m, n, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
   }
   else // if (INT(type) == TYPE_FLOAT)
   {
@@ -276,9 +333,63 @@ extern "C" SEXP R_hdfmat_fill_diag(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP ty
     for (int i=0; i<vlen; i++)
       v_f[i] = (float) v[i];
     
-    TRY_CATCH( fill_diag(vlen, v_f, m, n, dataset, H5::PredType::IEEE_F32LE) );
+    TRY_CATCH( fill_band(vlen, v_f, first, last, m, n, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
     std::free(v_f);
   }
   
+  stats_end(st);
+  return R_NilValue;
+}
+
+
+
+// Every element is written, so this is a single streamed pass like
+// fill_val() and no chunk is read.
+template <typename T>
+static inline void fill_identity(const hsize_t m, const hsize_t n,
+  const int storage, H5::DataSet *dataset, H5::PredType h5type)
+{
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), STREAM_MEM/2, storage, dataset);
+  
+  panel_stream<T> s(m, nr, n, nullptr,
+    [&](hsize_t i, hsize_t rows, const T *x) {
+      write_panel_stored(i, rows, n, x, storage, dataset, h5type);
+    }
+  );
+  
+  for (hsize_t i=0; i<m; i+=nr)
+  {
+    const hsize_t rows = std::min(nr, m-i);
+    const hsize_t c = stored_col_start(i, storage);
+    const hsize_t w = n - c;
+    T *x = s.next();
+    
+    std::memset(x, 0, rows*w*sizeof(*x));
+    for (hsize_t k=0; k<rows && i+k<n; k++)
+      x[(i+k-c) + w*k] = (T) 1;
+  }
+  
+  s.finish();
+}
+
+extern "C" SEXP R_hdfmat_fill_identity(SEXP m_, SEXP n_, SEXP ds, SEXP type,
+  SEXP storage)
+{
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
+  
+  const hsize_t m = (hsize_t) REAL(m_)[0];
+  const hsize_t n = (hsize_t) REAL(n_)[0];
+  
+  if (INT(type) == TYPE_DOUBLE)
+  {
+    TRY_CATCH( fill_identity<double>(m, n, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
+  }
+  else // if (INT(type) == TYPE_FLOAT)
+  {
+    TRY_CATCH( fill_identity<float>(m, n, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
+  }
+  
+  stats_end(st);
   return R_NilValue;
 }
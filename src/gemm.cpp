@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <float/float32.h>
+
+#include "hdfmat.h"
+#include "extptr.h"
+#include "omp.h"
+#include "panel.hh"
+#include "types.h"
+
+
+// Read columns [j, j+cols) of the k x n stored matrix B. For full storage this
+// is a row-major k x cols block, i.e. the column-major cols x k matrix t(B_j).
+// With symmetric storage the same columns are the rows [j, j+cols), read as a
+// row-major cols x k block, i.e. the column-major k x cols matrix B_j, which
+// gemm then uses transposed.
+template <typename T>
+static inline void read_cols(const hsize_t j, const hsize_t cols,
+  const hsize_t k, T *x, const int storage, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+  if (storage == STORAGE_SYM)
+    read_rows(j, cols, k, x, storage, dataset, h5type);
+  else
+    read_panel((hsize_t)0, k, j, cols, x, dataset, h5type);
+}
+
+
+
+// C = A*B for the stored m x k A, k x n B, and m x n C. Everything is
+// row-major on disk, so a row-major tile of C is the column-major t(C_ij) =
+// t(B_j)*t(A_i), with t(A_i) being the rows of A as read.
+//
+// If B fits in half the memory budget it is read once and kept, and the row
+// panels of A stream through it; each panel of C rows goes back into the A
+// panel's buffer and is written by the stream while the next panel is read.
+// Otherwise a band of A rows (a quarter of the budget) stays resident while
+// blocks of B columns stream past it, and each C tile is written from the B
+// block's buffer, so B is read once per band. Either way all HDF5 calls are
+// made by the one stream thread, and each tile is a single gemm (threaded by
+// the BLAS library). An int8 C can only be written whole rows at a time, so
+// there the tiles are gathered into the band's C rows, which are written once
+// the band is done.
+template <typename T>
+static inline void gemm_ooc(const hsize_t m, const hsize_t k, const hsize_t n,
+  const double mem, const int storage_a, H5::DataSet *dataset_a,
+  const int storage_b, H5::DataSet *dataset_b, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+  const double bytes_b = (double) k*n * sizeof(T);
+  
+  if (bytes_b <= mem/2 * 1024.0 * 1024.0)
+  {
+    T *B = panel_alloc<T>(k, n);
+    read_rows((hsize_t)0, k, n, B, storage_b, dataset_b, h5type);
+    
+    const hsize_t len = std::max(k, n);
+    const hsize_t nr = panel_rows_stored(m, len, sizeof(T), mem/8, storage_a, dataset_a);
+    T *C_p = panel_alloc<T>(nr, n);
+    
+    panel_stream<T> s(m, nr, len,
+      [&](hsize_t i, hsize_t rows, T *x) {
+        read_rows(i, rows, k, x, storage_a, dataset_a, h5type);
+      },
+      [&](hsize_t i, hsize_t rows, const T *x) {
+        write_panel(i, rows, (hsize_t)0, n, x, dataset, h5type);
+      }
+    );
+    
+    for (hsize_t i=0; i<m; i+=nr)
+    {
+      const int rows = (int) std::min(nr, m-i);
+      T *A_p = s.next();
+      fml::blas::gemm('N', 'N', (int)n, rows, (int)k, (T)1, B, (int)n, A_p, (int)k, (T)0, C_p, (int)n);
+      std::memcpy(A_p, C_p, (size_t)rows*n * sizeof(*C_p));
+    }
+    
+    s.finish();
+    std::free(B);
+    std::free(C_p);
+    return;
+  }
+  
+  const bool whole_rows = (compact_type(dataset) == TYPE_INT8);
+  const hsize_t nb = panel_rows_stored(m, whole_rows ? k+n : k, sizeof(T), mem/4, storage_a, dataset_a);
+  const hsize_t len = std::max(k, nb);
+  const hsize_t bn = panel_rows(n, len, sizeof(T), mem/4);
+  
+  const char op = (storage_b == STORAGE_SYM) ? 'T' : 'N';
+  T *A_i = panel_alloc<T>(nb, k);
+  T *C_ij = panel_alloc<T>(nb, bn);
+  T *C_i = whole_rows ? panel_alloc<T>(nb, n) : NULL;
+  
+  for (hsize_t i=0; i<m; i+=nb)
+  {
+    const int b = (int) std::min(nb, m-i);
+    read_rows(i, (hsize_t)b, k, A_i, storage_a, dataset_a, h5type);
+    
+    panel_stream<T> s(n, bn, len,
+      [&](hsize_t j, hsize_t cols, T *x) {
+        read_cols(j, cols, k, x, storage_b, dataset_b, h5type);
+      },
+      [&](hsize_t j, hsize_t cols, const T *x) {
+        if (!whole_rows)
+          write_panel(i, (hsize_t)b, j, cols, x, dataset, h5type);
+        else
+        {
+          for (int r=0; r<b; r++)
+            std::memcpy(C_i + n*r + j, x + cols*r, cols*sizeof(*x));
+        }
+      }
+    );
+    
+    for (hsize_t j=0; j<n; j+=bn)
+    {
+      const int cols = (int) std::min(bn, n-j);
+      T *B_j = s.next();
+      const int ld = (op == 'N') ? cols : (int)k;
+      fml::blas::gemm(op, 'N', cols, b, (int)k, (T)1, B_j, ld, A_i, (int)k, (T)0, C_ij, cols);
+      std::memcpy(B_j, C_ij, (size_t)b*cols * sizeof(*C_ij));
+    }
+    
+    s.finish();
+    if (whole_rows)
+      write_panel(i, (hsize_t)b, (hsize_t)0, n, C_i, dataset, h5type);
+  }
+  
+  std::free(A_i);
+  std::free(C_ij);
+  std::free(C_i);
+}
+
+extern "C" SEXP R_hdfmat_gemm_ooc(SEXP m_, SEXP k_, SEXP n_, SEXP ds_a,
+  SEXP storage_a, SEXP ds_b, SEXP storage_b, SEXP ds, SEXP type, SEXP mem_)
+{
+  H5::DataSet *dataset_a = (H5::DataSet*) getRptr(ds_a);
+  H5::DataSet *dataset_b = (H5::DataSet*) getRptr(ds_b);
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
+  
+  const hsize_t m = (hsize_t) DBL(m_);
+  const hsize_t k = (hsize_t) DBL(k_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const double mem = DBL(mem_);
+  
+  if (INT(type) == TYPE_DOUBLE)
+  {
+    TRY_CATCH( gemm_ooc<double>(m, k, n, mem, INT(storage_a), dataset_a, INT(storage_b), dataset_b, dataset, H5::PredType::IEEE_F64LE) );
+  }
+  else // if (INT(type) == TYPE_FLOAT)
+  {
+    TRY_CATCH( gemm_ooc<float>(m, k, n, mem, INT(storage_a), dataset_a, INT(storage_b), dataset_b, dataset, H5::PredType::IEEE_F32LE) );
+  }
+  
+  stats_end(st);
+  return R_NilValue;
+}
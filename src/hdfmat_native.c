@@ -6,39 +6,66 @@
 #include <stdlib.h>
 
 
-extern SEXP R_hdfmat_cp(SEXP x, SEXP ds);
-extern SEXP R_hdfmat_eigen_sym(SEXP k_, SEXP n_, SEXP ds, SEXP type);
-extern SEXP R_hdfmat_fill(SEXP ds, SEXP x, SEXP row_offset_, SEXP type);
-extern SEXP R_hdfmat_fill_diag(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP type);
+extern SEXP R_hdfmat_cache_info(SEXP cache_);
+extern SEXP R_hdfmat_cache_invalidate(SEXP cache_, SEXP row_start_, SEXP row_stop_);
+extern SEXP R_hdfmat_cache_new(SEXP m_, SEXP n_, SEXP ds, SEXP type, SEXP mem_);
+extern SEXP R_hdfmat_cp(SEXP x, SEXP ds, SEXP type, SEXP storage, SEXP mem_);
+extern SEXP R_hdfmat_cp_ooc(SEXP m_, SEXP n_, SEXP ds_x, SEXP storage_x, SEXP ds, SEXP type, SEXP storage, SEXP mem_);
+extern SEXP R_hdfmat_eigen_sym(SEXP k_, SEXP n_, SEXP ds, SEXP type, SEXP storage_, SEXP mem_, SEXP block_, SEXP seed_, SEXP mixed_);
+extern SEXP R_hdfmat_ew(SEXP m_, SEXP n_, SEXP ds, SEXP ops_, SEXP args_, SEXP type, SEXP storage);
+extern SEXP R_hdfmat_fill(SEXP ds, SEXP x, SEXP row_offset_, SEXP type, SEXP storage, SEXP colmajor_);
+extern SEXP R_hdfmat_fill_band(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP first_, SEXP last_, SEXP type, SEXP storage);
+extern SEXP R_hdfmat_fill_identity(SEXP m_, SEXP n_, SEXP ds, SEXP type, SEXP storage);
 extern SEXP R_hdfmat_fill_linspace(SEXP m_, SEXP n_, SEXP ds, SEXP start_, SEXP stop_, SEXP type);
-extern SEXP R_hdfmat_fill_rnorm(SEXP m_, SEXP n_, SEXP ds, SEXP mean_, SEXP sd_, SEXP type);
-extern SEXP R_hdfmat_fill_runif(SEXP m_, SEXP n_, SEXP ds, SEXP min_, SEXP max_, SEXP type);
-extern SEXP R_hdfmat_fill_val(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP type);
+extern SEXP R_hdfmat_fill_rnorm(SEXP m_, SEXP n_, SEXP ds, SEXP mean_, SEXP sd_, SEXP seed_, SEXP type);
+extern SEXP R_hdfmat_fill_runif(SEXP m_, SEXP n_, SEXP ds, SEXP min_, SEXP max_, SEXP seed_, SEXP type);
+extern SEXP R_hdfmat_fill_val(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP type, SEXP storage);
 extern SEXP R_hdfmat_finalize(SEXP fp, SEXP ds);
+extern SEXP R_hdfmat_gemm_ooc(SEXP m_, SEXP k_, SEXP n_, SEXP ds_a, SEXP storage_a, SEXP ds_b, SEXP storage_b, SEXP ds, SEXP type, SEXP mem_);
 extern SEXP R_hdfmat_inherit(SEXP fp, SEXP name);
-extern SEXP R_hdfmat_init(SEXP fp, SEXP name, SEXP nrows, SEXP ncols, SEXP type, SEXP compression);
+extern SEXP R_hdfmat_init(SEXP fp, SEXP name, SEXP nrows, SEXP ncols, SEXP type, SEXP storage, SEXP chunking, SEXP filters, SEXP filter_args);
+extern SEXP R_hdfmat_matmult(SEXP m_, SEXP n_, SEXP ds, SEXP x, SEXP trans_, SEXP type, SEXP storage, SEXP mem_);
+extern SEXP R_hdfmat_matmult_ooc(SEXP m_, SEXP n_, SEXP ds, SEXP x, SEXP trans_, SEXP type, SEXP storage, SEXP mem_, SEXP ds_out);
 extern SEXP R_hdfmat_open(SEXP filename, SEXP mode);
-extern SEXP R_hdfmat_read(SEXP row_start_, SEXP row_stop_, SEXP col_start_, SEXP col_stop_, SEXP ds, SEXP type, SEXP asis);
-extern SEXP R_hdfmat_scale(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP type);
-extern SEXP R_hdfmat_svd(SEXP k_, SEXP m_, SEXP n_, SEXP ds, SEXP type);
-extern SEXP R_hdfmat_tcp(SEXP x, SEXP ds);
+extern SEXP R_hdfmat_reduce(SEXP m_, SEXP n_, SEXP ds, SEXP what_, SEXP type, SEXP storage_);
+extern SEXP R_hdfmat_reigen_sym(SEXP k_, SEXP l_, SEXP passes_, SEXP n_, SEXP ds, SEXP type, SEXP storage_, SEXP mem_, SEXP seed_);
+extern SEXP R_hdfmat_read(SEXP row_start_, SEXP row_stop_, SEXP col_start_, SEXP col_stop_, SEXP ds, SEXP type, SEXP asis, SEXP storage, SEXP cache_);
+extern SEXP R_hdfmat_rsvd(SEXP k_, SEXP l_, SEXP passes_, SEXP m_, SEXP n_, SEXP ds, SEXP type, SEXP storage_, SEXP mem_, SEXP seed_);
+extern SEXP R_hdfmat_stats(SEXP ds, SEXP reset_);
+extern SEXP R_hdfmat_svd(SEXP k_, SEXP m_, SEXP n_, SEXP ds, SEXP type, SEXP mem_, SEXP seed_, SEXP mixed_);
+extern SEXP R_hdfmat_tcp(SEXP x, SEXP ds, SEXP type, SEXP storage, SEXP mem_);
+extern SEXP R_hdfmat_tcp_ooc(SEXP m_, SEXP n_, SEXP ds_x, SEXP storage_x, SEXP ds, SEXP type, SEXP storage, SEXP mem_);
 
 static const R_CallMethodDef CallEntries[] = {
-  {"R_hdfmat_cp", (DL_FUNC) &R_hdfmat_cp, 2},
-  {"R_hdfmat_eigen_sym", (DL_FUNC) &R_hdfmat_eigen_sym, 4},
-  {"R_hdfmat_fill", (DL_FUNC) &R_hdfmat_fill, 4},
-  {"R_hdfmat_fill_diag", (DL_FUNC) &R_hdfmat_fill_diag, 5},
+  {"R_hdfmat_cache_info", (DL_FUNC) &R_hdfmat_cache_info, 1},
+  {"R_hdfmat_cache_invalidate", (DL_FUNC) &R_hdfmat_cache_invalidate, 3},
+  {"R_hdfmat_cache_new", (DL_FUNC) &R_hdfmat_cache_new, 5},
+  {"R_hdfmat_cp", (DL_FUNC) &R_hdfmat_cp, 5},
+  {"R_hdfmat_cp_ooc", (DL_FUNC) &R_hdfmat_cp_ooc, 8},
+  {"R_hdfmat_eigen_sym", (DL_FUNC) &R_hdfmat_eigen_sym, 9},
+  {"R_hdfmat_ew", (DL_FUNC) &R_hdfmat_ew, 7},
+  {"R_hdfmat_fill", (DL_FUNC) &R_hdfmat_fill, 6},
+  {"R_hdfmat_fill_band", (DL_FUNC) &R_hdfmat_fill_band, 8},
+  {"R_hdfmat_fill_identity", (DL_FUNC) &R_hdfmat_fill_identity, 5},
   {"R_hdfmat_fill_linspace", (DL_FUNC) &R_hdfmat_fill_linspace, 6},
-  {"R_hdfmat_fill_runif", (DL_FUNC) &R_hdfmat_fill_runif, 6},
-  {"R_hdfmat_fill_val", (DL_FUNC) &R_hdfmat_fill_val, 5},
+  {"R_hdfmat_fill_rnorm", (DL_FUNC) &R_hdfmat_fill_rnorm, 7},
+  {"R_hdfmat_fill_runif", (DL_FUNC) &R_hdfmat_fill_runif, 7},
+  {"R_hdfmat_fill_val", (DL_FUNC) &R_hdfmat_fill_val, 6},
   {"R_hdfmat_finalize", (DL_FUNC) &R_hdfmat_finalize, 2},
+  {"R_hdfmat_gemm_ooc", (DL_FUNC) &R_hdfmat_gemm_ooc, 10},
   {"R_hdfmat_inherit", (DL_FUNC) &R_hdfmat_inherit, 2},
-  {"R_hdfmat_init", (DL_FUNC) &R_hdfmat_init, 6},
-  {"R_hdfmat_read", (DL_FUNC) &R_hdfmat_read, 7},
+  {"R_hdfmat_init", (DL_FUNC) &R_hdfmat_init, 9},
+  {"R_hdfmat_matmult", (DL_FUNC) &R_hdfmat_matmult, 8},
+  {"R_hdfmat_matmult_ooc", (DL_FUNC) &R_hdfmat_matmult_ooc, 9},
+  {"R_hdfmat_reduce", (DL_FUNC) &R_hdfmat_reduce, 6},
+  {"R_hdfmat_reigen_sym", (DL_FUNC) &R_hdfmat_reigen_sym, 9},
+  {"R_hdfmat_read", (DL_FUNC) &R_hdfmat_read, 9},
   {"R_hdfmat_open", (DL_FUNC) &R_hdfmat_open, 2},
-  {"R_hdfmat_scale", (DL_FUNC) &R_hdfmat_scale, 5},
-  {"R_hdfmat_svd", (DL_FUNC) &R_hdfmat_svd, 5},
-  {"R_hdfmat_tcp", (DL_FUNC) &R_hdfmat_tcp, 2},
+  {"R_hdfmat_rsvd", (DL_FUNC) &R_hdfmat_rsvd, 10},
+  {"R_hdfmat_stats", (DL_FUNC) &R_hdfmat_stats, 2},
+  {"R_hdfmat_svd", (DL_FUNC) &R_hdfmat_svd, 8},
+  {"R_hdfmat_tcp", (DL_FUNC) &R_hdfmat_tcp, 5},
+  {"R_hdfmat_tcp_ooc", (DL_FUNC) &R_hdfmat_tcp_ooc, 8},
   {NULL, NULL, 0}
 };
 
@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include "compact.hh"
+#include "stats.hh"
 
 #include "hdfmat.h"
 #include "extptr.h"
@@ -20,54 +27,323 @@ extern "C" SEXP R_hdfmat_open(SEXP filename, SEXP fm)
 
 
 
-static inline H5::DSetCreatPropList get_plist(const hsize_t dim[2], const int compression)
+static const char *chunking_str[] = {"", "rows", "cols", "tiles", "contiguous"};
+
+
+
+// chunk dimensions of about CHUNK_BYTES for the chunking policy: whole rows,
+// tall column blocks, or near-square tiles
+static inline void chunk_dims(const hsize_t dim[2], const size_t size,
+  const int chunking, hsize_t dim_chunk[2])
+{
+  const hsize_t len = std::max((hsize_t)1, (hsize_t) (CHUNK_BYTES / size));
+  
+  if (chunking == CHUNK_ROWS)
+  {
+    dim_chunk[1] = dim[1];
+    dim_chunk[0] = std::max((hsize_t)1, std::min(dim[0], len / dim[1]));
+  }
+  else if (chunking == CHUNK_COLS)
+  {
+    dim_chunk[0] = std::min(dim[0], len);
+    dim_chunk[1] = std::max((hsize_t)1, std::min(dim[1], len / dim_chunk[0]));
+  }
+  else // if (chunking == CHUNK_TILES)
+  {
+    const hsize_t t = std::max((hsize_t)1, (hsize_t) std::sqrt((double) len));
+    dim_chunk[0] = std::min(dim[0], t);
+    dim_chunk[1] = std::max((hsize_t)1, std::min(dim[1], len / dim_chunk[0]));
+    dim_chunk[0] = std::max((hsize_t)1, std::min(dim[0], len / dim_chunk[1]));
+  }
+}
+
+static inline H5::DSetCreatPropList get_plist(const hsize_t dim[2],
+  const size_t size, const int chunking)
 {
-  const hsize_t max_contig_rows = 1;
+  H5::DSetCreatPropList plist;
+  if (chunking == CHUNK_CONTIGUOUS)
+    return plist;
   
   hsize_t dim_chunk[2];
-  dim_chunk[0] = dim[0] > max_contig_rows ? max_contig_rows : dim[0];
-  dim_chunk[1] = dim[1];
+  chunk_dims(dim, size, chunking, dim_chunk);
   
-  H5::DSetCreatPropList plist;
   plist.setChunk(2, dim_chunk);
-  plist.setDeflate(compression);
   
   return plist;
 }
 
-static inline H5::DataSet *init(H5::H5File *file, const char *name,
-  const hsize_t dim[2], const int cp, const int type)
+// tiles below the diagonal are never written, so their chunks are never
+// allocated
+static inline H5::DSetCreatPropList get_plist_sym(const hsize_t dim[2])
 {
-  H5::DataSpace data_space(2, dim);
+  hsize_t dim_chunk[2];
+  dim_chunk[0] = dim[0] > SYM_TILE ? SYM_TILE : dim[0];
+  dim_chunk[1] = dim_chunk[0];
   
-  H5::DataSet *dataset = new H5::DataSet;
-  if (type == TYPE_DOUBLE)
+  H5::DSetCreatPropList plist;
+  plist.setChunk(2, dim_chunk);
+  plist.setAllocTime(H5D_ALLOC_TIME_INCR);
+  
+  return plist;
+}
+
+
+
+// Filter pipeline, applied in the given order. args are the deflate level,
+// the number of decimal digits kept by scale-offset, and the number of
+// mantissa bits kept by n-bit.
+static inline void set_filters(const H5::DSetCreatPropList &plist,
+  const int nfilters, const int *filters, const int *args)
+{
+  for (int i=0; i<nfilters; i++)
   {
-    H5::DataType datatype(H5::PredType::IEEE_F64LE);
-    if (cp > 0)
+    if (filters[i] == FILTER_SHUFFLE)
+      plist.setShuffle();
+    else if (filters[i] == FILTER_DEFLATE)
+      plist.setDeflate(args[i]);
+    else if (filters[i] == FILTER_NBIT)
+      plist.setNbit();
+    else if (filters[i] == FILTER_SCALEOFFSET)
     {
-      auto plist = get_plist(dim, cp);
-      *dataset = file->createDataSet(name, datatype, data_space, plist);
+      if (H5Pset_scaleoffset(plist.getId(), H5Z_SO_FLOAT_DSCALE, args[i]) < 0)
+        throw std::runtime_error("unable to set the scale-offset filter");
     }
-    else
-      *dataset = file->createDataSet(name, datatype, data_space);
   }
-  else // if (INT(type) == TYPE_FLOAT)
+}
+
+// n-bit only packs the significant bits of the file type, so for n-bit the
+// file type is the IEEE type with all but the top `bits` mantissa bits
+// dropped; HDF5 converts to and from it on I/O
+static inline void nbit_type(H5::FloatType &datatype, const int bits)
+{
+  size_t spos, epos, esize, mpos, msize;
+  datatype.getFields(spos, epos, esize, mpos, msize);
+  
+  const size_t size = datatype.getSize();
+  const size_t keep = std::min((size_t)bits, msize);
+  const size_t offset = mpos + msize - keep;
+  
+  datatype.setFields(spos, epos, esize, offset, keep);
+  datatype.setOffset(offset);
+  datatype.setPrecision(spos + 1 - offset);
+  datatype.setSize(size);
+}
+
+static inline void get_filters(H5::DataSet *dataset, int *nfilters,
+  int *filters, int *args)
+{
+  H5::DSetCreatPropList plist = dataset->getCreatePlist();
+  const int n = plist.getNfilters();
+  
+  *nfilters = 0;
+  for (int i=0; i<n; i++)
   {
-    H5::DataType datatype(H5::PredType::IEEE_F32LE);
-    if (cp > 0)
+    unsigned int flags, config;
+    unsigned int cd_values[20];
+    size_t cd_nelmts = 20;
+    char filter_name[64];
+    H5Z_filter_t id = plist.getFilter(i, flags, cd_nelmts, cd_values, 64, filter_name, config);
+    
+    int filter, arg = 0;
+    if (id == H5Z_FILTER_SHUFFLE)
+      filter = FILTER_SHUFFLE;
+    else if (id == H5Z_FILTER_DEFLATE)
+    {
+      filter = FILTER_DEFLATE;
+      arg = cd_nelmts > 0 ? cd_values[0] : 0;
+    }
+    else if (id == H5Z_FILTER_NBIT)
     {
-      auto plist = get_plist(dim, cp);
-      *dataset = file->createDataSet(name, datatype, data_space, plist);
+      size_t spos, epos, esize, mpos, msize;
+      dataset->getFloatType().getFields(spos, epos, esize, mpos, msize);
+      filter = FILTER_NBIT;
+      arg = (int) msize;
+    }
+    else if (id == H5Z_FILTER_SCALEOFFSET)
+    {
+      filter = FILTER_SCALEOFFSET;
+      arg = cd_nelmts > 1 ? cd_values[1] : 0;
     }
     else
-      *dataset = file->createDataSet(name, datatype, data_space);
+      continue;
+    
+    filters[*nfilters] = filter;
+    args[*nfilters] = arg;
+    (*nfilters)++;
+  }
+}
+
+
+
+static inline size_t next_prime(size_t n)
+{
+  for (;; n++)
+  {
+    bool prime = (n > 1);
+    for (size_t d=2; d*d<=n && prime; d++)
+      prime = (n % d != 0);
+    
+    if (prime)
+      return n;
+  }
+}
+
+// The chunk cache is not stored in the file, so it is set up from the chunk
+// shape every time the dataset is created or opened. It holds one row of
+// chunks so that row panels which do not line up with the chunks, and
+// partial writes, do not re-read and re-decompress their chunks.
+static inline H5::DSetAccPropList get_aplist(const H5::DSetCreatPropList &plist,
+  const hsize_t dim[2], const size_t size)
+{
+  H5::DSetAccPropList aplist;
+  if (plist.getLayout() != H5D_CHUNKED)
+    return aplist;
+  
+  hsize_t dim_chunk[2];
+  plist.getChunk(2, dim_chunk);
+  
+  const size_t chunk_bytes = dim_chunk[0] * dim_chunk[1] * size;
+  const size_t row_chunks = (dim[1] + dim_chunk[1] - 1) / dim_chunk[1];
+  
+  size_t nbytes = row_chunks * chunk_bytes;
+  nbytes = std::max((size_t)CHUNK_CACHE_MIN, std::min((size_t)CHUNK_CACHE_MAX, nbytes));
+  
+  // HDF5 suggests about 100 times as many hash slots as cached chunks
+  const size_t nchunks = std::max((size_t)1, nbytes / chunk_bytes);
+  const size_t nslots = next_prime(100 * nchunks);
+  
+  // chunks are streamed through in order, so evict fully read/written ones
+  // first
+  aplist.setChunkCache(nslots, nbytes, 1.0);
+  
+  return aplist;
+}
+
+
+
+static inline void set_str_attr(H5::DataSet *dataset, const char *name,
+  const char *value)
+{
+  H5::StrType str_type(H5::PredType::C_S1, H5T_VARIABLE);
+  H5::DataSpace attr_space(H5S_SCALAR);
+  H5::Attribute attr = dataset->createAttribute(name, str_type, attr_space);
+  attr.write(str_type, std::string(value));
+}
+
+static inline std::string get_str_attr(H5::DataSet *dataset, const char *name)
+{
+  std::string value;
+  if (!dataset->attrExists(name))
+    return value;
+  
+  H5::Attribute attr = dataset->openAttribute(name);
+  attr.read(attr.getStrType(), value);
+  
+  return value;
+}
+
+static inline int get_storage_attr(H5::DataSet *dataset)
+{
+  if (get_str_attr(dataset, STORAGE_ATTR) == STORAGE_SYM_STR)
+    return STORAGE_SYM;
+  else
+    return STORAGE_FULL;
+}
+
+// files written before the attribute existed are classified by their layout
+static inline std::string get_chunking_attr(H5::DataSet *dataset,
+  const hsize_t dim[2])
+{
+  std::string chunking = get_str_attr(dataset, CHUNK_ATTR);
+  if (!chunking.empty())
+    return chunking;
+  
+  H5::DSetCreatPropList plist = dataset->getCreatePlist();
+  if (plist.getLayout() != H5D_CHUNKED)
+    return chunking_str[CHUNK_CONTIGUOUS];
+  
+  hsize_t dim_chunk[2];
+  plist.getChunk(2, dim_chunk);
+  if (dim_chunk[1] == dim[1])
+    return chunking_str[CHUNK_ROWS];
+  else
+    return chunking_str[CHUNK_TILES];
+}
+
+// file type of the float types; int8 matrices are stored as STD_I8LE
+static inline H5::FloatType float_type(const int type)
+{
+  if (type == TYPE_DOUBLE)
+    return H5::FloatType(H5::PredType::IEEE_F64LE);
+  else if (type == TYPE_FLOAT16)
+    return float16_type();
+  else if (type == TYPE_BFLOAT16)
+    return bfloat16_type();
+  else
+    return H5::FloatType(H5::PredType::IEEE_F32LE);
+}
+
+static inline H5::DataSet *init(H5::H5File *file, const char *name,
+  const hsize_t dim[2], const int type, const int storage, const int chunking,
+  const int nfilters, const int *filters, const int *args)
+{
+  if (type == TYPE_INT8 && storage == STORAGE_SYM)
+    throw std::runtime_error("int8 matrices do not support symmetric storage");
+  
+  H5::DataSpace data_space(2, dim);
+  
+  H5::FloatType datatype = float_type(type);
+  H5::IntType qtype(H5::PredType::STD_I8LE);
+  
+  for (int i=0; i<nfilters; i++)
+  {
+    if (filters[i] == FILTER_NBIT)
+      nbit_type(datatype, args[i]);
   }
   
+  const size_t size = (type == TYPE_INT8) ? 1 : datatype.getSize();
+  
+  H5::DSetCreatPropList plist = (storage == STORAGE_SYM) ?
+    get_plist_sym(dim) : get_plist(dim, size, chunking);
+  
+  set_filters(plist, nfilters, filters, args);
+  H5::DSetAccPropList aplist = get_aplist(plist, dim, size);
+  
+  H5::DataSet *dataset = new H5::DataSet;
+  if (type == TYPE_INT8)
+  {
+    *dataset = file->createDataSet(name, qtype, data_space, plist, aplist);
+    
+    H5::DataSpace scale_space(1, dim);
+    file->createDataSet(std::string(name) + QSCALE_SUFFIX, H5::PredType::IEEE_F32LE, scale_space);
+  }
+  else
+    *dataset = file->createDataSet(name, datatype, data_space, plist, aplist);
+  
+  if (storage == STORAGE_SYM)
+    set_str_attr(dataset, STORAGE_ATTR, STORAGE_SYM_STR);
+  
+  set_str_attr(dataset, CHUNK_ATTR, chunking_str[chunking]);
+  stats_reset(dataset);
+  qscale_close(dataset);
+  
   return dataset;
 }
 
-extern "C" SEXP R_hdfmat_init(SEXP fp, SEXP name, SEXP nrows, SEXP ncols, SEXP type, SEXP compression)
+// the dataset's counters and int8 scales go with it
+static void dataset_finalizer(SEXP Rptr)
+{
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(Rptr);
+  if (dataset != NULL)
+  {
+    stats_reset(dataset);
+    qscale_close(dataset);
+  }
+  
+  hdf_object_finalizer<H5::DataSet>(Rptr);
+}
+
+extern "C" SEXP R_hdfmat_init(SEXP fp, SEXP name, SEXP nrows, SEXP ncols, SEXP type, SEXP storage, SEXP chunking, SEXP filters, SEXP filter_args)
 {
   SEXP ret;
   
@@ -78,9 +354,9 @@ extern "C" SEXP R_hdfmat_init(SEXP fp, SEXP name, SEXP nrows, SEXP ncols, SEXP t
   dim[1] = DBL(ncols);
   
   H5::DataSet *dataset;
-  TRY_CATCH( dataset = init(file, CHARPT(name, 0), dim, INT(compression), INT(type)) );
+  TRY_CATCH( dataset = init(file, CHARPT(name, 0), dim, INT(type), INT(storage), INT(chunking), LENGTH(filters), INTEGER(filters), INTEGER(filter_args)) );
   
-  newRptr(dataset, ret, hdf_object_finalizer<H5::DataSet>);
+  newRptr(dataset, ret, dataset_finalizer);
   UNPROTECT(1);
   return ret;
 }
@@ -89,7 +365,7 @@ extern "C" SEXP R_hdfmat_init(SEXP fp, SEXP name, SEXP nrows, SEXP ncols, SEXP t
 
 extern "C" SEXP R_hdfmat_inherit(SEXP fp, SEXP name)
 {
-  SEXP ds, Rdims, type, ret;
+  SEXP ds, Rdims, type, storage, chunking, filters, filter_args, ret;
   
   H5::H5File *file = (H5::H5File*) getRptr(fp);
   
@@ -99,13 +375,17 @@ extern "C" SEXP R_hdfmat_inherit(SEXP fp, SEXP name)
     *dataset = file->openDataSet(CHARPT(name, 0));
     
     auto type_class = dataset->getTypeClass();
-    if (type_class != H5T_FLOAT)
+    const int compact = compact_type(dataset);
+    if (type_class == H5T_INTEGER && compact == 0 && dataset->getDataType().getSize() == 1 && dataset->getIntType().getSign() == H5T_SGN_2)
+      error("int8 matrix without its row scales");
+    if (type_class != H5T_FLOAT && compact != TYPE_INT8)
       error("only float types are supported");
-    auto h5flt_type = dataset->getFloatType();
-    size_t sz = h5flt_type.getSize();
+    size_t sz = dataset->getDataType().getSize();
     
     PROTECT(type = allocVector(INTSXP, 1));
-    if (sz == 8)
+    if (compact != 0)
+      INT(type) = compact;
+    else if (sz == 8)
       INT(type) = TYPE_DOUBLE;
     else if (sz == 4) 
       INT(type) = TYPE_FLOAT;
@@ -120,21 +400,52 @@ extern "C" SEXP R_hdfmat_inherit(SEXP fp, SEXP name)
     hsize_t dims[2];
     dataspace.getSimpleExtentDims(dims, NULL);
     
-    newRptr(dataset, ds, hdf_object_finalizer<H5::DataSet>);
+    PROTECT(storage = allocVector(INTSXP, 1));
+    INT(storage) = get_storage_attr(dataset);
+    
+    PROTECT(chunking = mkString(get_chunking_attr(dataset, dims).c_str()));
+    
+    int nfilters;
+    int filters_buf[H5Z_MAX_NFILTERS], args_buf[H5Z_MAX_NFILTERS];
+    get_filters(dataset, &nfilters, filters_buf, args_buf);
+    
+    PROTECT(filters = allocVector(INTSXP, nfilters));
+    PROTECT(filter_args = allocVector(INTSXP, nfilters));
+    for (int i=0; i<nfilters; i++)
+    {
+      INTEGER(filters)[i] = filters_buf[i];
+      INTEGER(filter_args)[i] = args_buf[i];
+    }
+    
+    // reopen with a chunk cache fitted to the chunk shape
+    H5::DSetCreatPropList plist = dataset->getCreatePlist();
+    if (plist.getLayout() == H5D_CHUNKED)
+    {
+      H5::DSetAccPropList aplist = get_aplist(plist, dims, sz);
+      dataset->close();
+      *dataset = file->openDataSet(CHARPT(name, 0), aplist);
+    }
+    
+    stats_reset(dataset);
+    newRptr(dataset, ds, dataset_finalizer);
     
     PROTECT(Rdims = allocVector(REALSXP, 2));
     for (int i=0; i<ndims; i++)
       REAL(Rdims)[i] = (double) dims[i];
     
-    PROTECT(ret = allocVector(VECSXP, 3));
+    PROTECT(ret = allocVector(VECSXP, 7));
     SET_VECTOR_ELT(ret, 0, ds);
     SET_VECTOR_ELT(ret, 1, Rdims);
     SET_VECTOR_ELT(ret, 2, type);
+    SET_VECTOR_ELT(ret, 3, storage);
+    SET_VECTOR_ELT(ret, 4, chunking);
+    SET_VECTOR_ELT(ret, 5, filters);
+    SET_VECTOR_ELT(ret, 6, filter_args);
   }
   catch(const std::exception& e) { error(e.what()); }
   catch (const H5::Exception& e) { error(e.getCDetailMsg()); }
   
-  UNPROTECT(4);
+  UNPROTECT(8);
   return ret;
 }
 
@@ -145,6 +456,8 @@ extern "C" SEXP R_hdfmat_finalize(SEXP fp, SEXP ds)
   H5::H5File *file = (H5::H5File*) getRptr(fp);
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
   
+  stats_reset(dataset);
+  qscale_close(dataset);
   TRY_CATCH( dataset->close() );
   TRY_CATCH( file->close() );
   
@@ -1,80 +1,218 @@
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <mutex>
 
 #include <float/float32.h>
 
 #include "hdfmat.h"
 #include "extptr.h"
+#include "cache.hh"
+#include "panel.hh"
 #include "types.h"
 
 
 template <typename T>
 static inline void write(const hsize_t m, const hsize_t n,
-  const hsize_t row_offset, T *x, H5::DataSet *dataset, H5::PredType h5type)
+  const hsize_t row_offset, T *x, const int storage, H5::DataSet *dataset,
+  H5::PredType h5type)
 {
-  hsize_t slice[2];
-  slice[0] = m;
-  slice[1] = n;
-  
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
-  
-  hsize_t offset[2];
-  offset[0] = row_offset;
-  offset[1] = 0;
-  
-  data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-  dataset->write(x, h5type, mem_space, data_space);
+  if (storage == STORAGE_SYM)
+    write_panel_sym(row_offset, m, (hsize_t)0, n, x, dataset, h5type);
+  else
+    write_panel(row_offset, m, (hsize_t)0, n, x, dataset, h5type);
 }
 
-extern "C" SEXP R_hdfmat_fill(SEXP ds, SEXP x, SEXP row_offset_, SEXP type)
+// Column-major x is transposed and converted into the file's row-major layout
+// a panel at a time. Row-major ("as is") x is written directly and HDF5
+// converts S to the file type on the way.
+template <typename T, typename S>
+static inline void fill(const hsize_t m, const hsize_t n,
+  const hsize_t row_offset, S *x, const bool colmajor, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type_x, H5::PredType h5type)
+{
+  if (colmajor)
+    write_colmajor<T>(row_offset, m, n, x, m, storage, dataset, h5type);
+  else
+    write(m, n, row_offset, x, storage, dataset, h5type_x);
+}
+
+// x is a double matrix or the data of a float32 matrix
+extern "C" SEXP R_hdfmat_fill(SEXP ds, SEXP x, SEXP row_offset_, SEXP type,
+  SEXP storage, SEXP colmajor_)
 {
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const hsize_t m = (hsize_t) nrows(x);
   const hsize_t n = (hsize_t) ncols(x);
   
   const hsize_t row_offset = (hsize_t) DBL(row_offset_);
+  const bool colmajor = (bool) LOGICAL(colmajor_)[0];
+  const bool x_dbl = (TYPEOF(x) == REALSXP);
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    TRY_CATCH( write(m, n, row_offset, REAL(x), dataset, H5::PredType::IEEE_F64LE) );
+    if (x_dbl)
+    {
+      TRY_CATCH( fill<double>(m, n, row_offset, REAL(x), colmajor, INT(storage), dataset, H5::PredType::IEEE_F64LE, H5::PredType::IEEE_F64LE) );
+    }
+    else
+    {
+      TRY_CATCH( fill<double>(m, n, row_offset, FLOAT(x), colmajor, INT(storage), dataset, H5::PredType::IEEE_F32LE, H5::PredType::IEEE_F64LE) );
+    }
   }
   else // if (INT(type) == TYPE_FLOAT)
   {
-    TRY_CATCH( write(m, n, row_offset, FLOAT(x), dataset, H5::PredType::IEEE_F32LE) );
+    if (x_dbl)
+    {
+      TRY_CATCH( fill<float>(m, n, row_offset, REAL(x), colmajor, INT(storage), dataset, H5::PredType::IEEE_F64LE, H5::PredType::IEEE_F32LE) );
+    }
+    else
+    {
+      TRY_CATCH( fill<float>(m, n, row_offset, FLOAT(x), colmajor, INT(storage), dataset, H5::PredType::IEEE_F32LE, H5::PredType::IEEE_F32LE) );
+    }
   }
   
+  stats_end(st);
   return R_NilValue;
 }
 
 
 
 template <typename T>
-static inline void read(const hsize_t row_start, const hsize_t row_stop,
+static inline void read_hdf5(const hsize_t row_start, const hsize_t row_stop,
   const hsize_t col_start, const hsize_t col_stop,
-  T *x, H5::DataSet *dataset,
+  T *x, const int storage, H5::DataSet *dataset,
   H5::PredType h5type)
 {
-  hsize_t slice[2];
-  slice[0] = row_stop - row_start + 1;
-  slice[1] = col_stop - col_start + 1;
+  const hsize_t rows = row_stop - row_start + 1;
+  const hsize_t cols = col_stop - col_start + 1;
+  
+  if (storage == STORAGE_SYM)
+    read_panel_sym(row_start, rows, col_start, cols, x, dataset, h5type);
+  else
+    read_panel(row_start, rows, col_start, cols, x, dataset, h5type);
+}
+
+
+
+// read_hdf5() through the row cache: the blocks of full rows covering the
+// range are taken from the cache, or read whole and kept there, and the
+// requested columns are copied out of them. May run on a stream thread.
+template <typename T>
+static inline void read_cached(const hsize_t row_start, const hsize_t row_stop,
+  const hsize_t col_start, const hsize_t col_stop,
+  T *x, const int storage, H5::DataSet *dataset,
+  H5::PredType h5type, row_cache *cache)
+{
+  hsize_t dims[2];
+  dataset->getSpace().getSimpleExtentDims(dims, NULL);
+  const hsize_t m = dims[0];
+  const hsize_t n = dims[1];
+  
+  const hsize_t br = cache->rows();
+  const hsize_t cols = col_stop - col_start + 1;
+  if (br*n*sizeof(T) > cache->limit())
+    return read_hdf5(row_start, row_stop, col_start, col_stop, x, storage, dataset, h5type);
+  
+  std::lock_guard<std::mutex> lock(cache->mutex());
+  for (hsize_t b=row_start/br; b<=row_stop/br; b++)
+  {
+    const hsize_t first = b*br;
+    const hsize_t rows = std::min(br, m - first);
+    
+    T *block = (T*) cache->get(b);
+    if (block == NULL)
+    {
+      block = (T*) cache->put(b, rows*n*sizeof(T));
+      try
+      {
+        read_rows(first, rows, n, block, storage, dataset, h5type);
+      }
+      catch (...)
+      {
+        cache->invalidate(b, b);
+        throw;
+      }
+    }
+    
+    const hsize_t r0 = std::max(first, row_start);
+    const hsize_t r1 = std::min(first + rows - 1, row_stop);
+    for (hsize_t r=r0; r<=r1; r++)
+      std::memcpy(x + (r - row_start)*cols, block + (r - first)*n + col_start, cols*sizeof(T));
+  }
+}
+
+
+
+// Read the block into x, row-major ("as is") or column-major. With a row
+// cache the blocks come from it. Otherwise mapped datasets are copied or
+// transposed straight out of the file's pages. Column-major reads that are
+// not mapped go a panel of rows at a time through a small buffer, transposed
+// into x while the next panel is read, so no full-size row-major copy is made.
+template <typename T>
+static inline void read(const hsize_t row_start, const hsize_t row_stop,
+  const hsize_t col_start, const hsize_t col_stop, T *x, const bool colmajor,
+  const int storage, H5::DataSet *dataset, H5::PredType h5type,
+  row_cache *cache)
+{
+  const hsize_t rows = row_stop - row_start + 1;
+  const hsize_t cols = col_stop - col_start + 1;
+  
+  if (cache == NULL)
+  {
+    const dataset_map map(dataset, h5type, false);
+    if (map.data() != NULL)
+    {
+      const hsize_t n = map.ncols();
+      const T *A = map.rows<T>() + row_start*n + col_start;
+      
+      if (colmajor)
+        transpose(rows, cols, A, n, x, rows);
+      else
+      {
+        for (hsize_t i=0; i<rows; i++)
+          std::memcpy(x + i*cols, A + i*n, cols*sizeof(T));
+      }
+      
+      map.used((double) (rows*cols*sizeof(T)));
+      return;
+    }
+  }
+  
+  auto read_block = [&](hsize_t i, hsize_t r, T *buf) {
+    if (cache == NULL)
+      read_hdf5(i, i+r-1, col_start, col_stop, buf, storage, dataset, h5type);
+    else
+      read_cached(i, i+r-1, col_start, col_stop, buf, storage, dataset, h5type, cache);
+  };
+  
+  if (!colmajor)
+    return read_block(row_start, rows, x);
   
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
+  const hsize_t nr = panel_rows(rows, cols, sizeof(T), TRANSPOSE_MEM/2);
+  panel_stream<T> s(rows, nr, cols, [&](hsize_t i, hsize_t r, T *buf) {
+    read_block(row_start+i, r, buf);
+  });
   
-  hsize_t offset[2];
-  offset[0] = row_start;
-  offset[1] = col_start;
+  for (hsize_t i=0; i<rows; i+=nr)
+  {
+    const hsize_t r = std::min(nr, rows-i);
+    const T *buf = s.next();
+    transpose(r, cols, buf, cols, x+i, rows);
+  }
   
-  data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-  dataset->read(x, h5type, mem_space, data_space);
+  s.finish();
 }
 
-extern "C" SEXP R_hdfmat_read(SEXP row_start_, SEXP row_stop_, SEXP col_start_, SEXP col_stop_, SEXP ds, SEXP type, SEXP asis)
+extern "C" SEXP R_hdfmat_read(SEXP row_start_, SEXP row_stop_, SEXP col_start_, SEXP col_stop_, SEXP ds, SEXP type, SEXP asis, SEXP storage, SEXP cache_)
 {
   SEXP ret;
   
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  row_cache *cache = (TYPEOF(cache_) == EXTPTRSXP) ? (row_cache*) getRptr(cache_) : NULL;
+  io_stats *st = stats_begin(dataset);
   
   const hsize_t row_start = (hsize_t) DBL(row_start_);
   const hsize_t row_stop = (hsize_t) DBL(row_stop_);
@@ -84,29 +222,22 @@ extern "C" SEXP R_hdfmat_read(SEXP row_start_, SEXP row_stop_, SEXP col_start_,
   const hsize_t col_stop = (hsize_t) DBL(col_stop_);
   const hsize_t col_len = col_stop - col_start + 1;
   
-  hsize_t m, n;
-  if (!INT(asis))
-  {
-    m = col_len;
-    n = row_len;
-  }
-  else
-  {
-    m = row_len;
-    n = col_len;
-  }
+  // either way the result is row_len x col_len; "as is" it holds the
+  // row-major data unchanged
+  const bool colmajor = !INT(asis);
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    PROTECT(ret = allocMatrix(REALSXP, m, n));
-    TRY_CATCH( read(row_start, row_stop, col_start, col_stop, REAL(ret), dataset, H5::PredType::IEEE_F64LE) );
+    PROTECT(ret = allocMatrix(REALSXP, row_len, col_len));
+    TRY_CATCH( read(row_start, row_stop, col_start, col_stop, REAL(ret), colmajor, INT(storage), dataset, H5::PredType::IEEE_F64LE, cache) );
   }
   else // if (INT(type) == TYPE_FLOAT)
   {
-    PROTECT(ret = allocMatrix(INTSXP, m, n));
-    TRY_CATCH( read(row_start, row_stop, col_start, col_stop, FLOAT(ret), dataset, H5::PredType::IEEE_F32LE) );
+    PROTECT(ret = allocMatrix(INTSXP, row_len, col_len));
+    TRY_CATCH( read(row_start, row_stop, col_start, col_stop, FLOAT(ret), colmajor, INT(storage), dataset, H5::PredType::IEEE_F32LE, cache) );
   }
   
+  stats_end(st);
   UNPROTECT(1);
   return ret;
 }
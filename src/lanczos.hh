@@ -8,12 +8,17 @@
 #include <cstring>
 
 #include "omp.h"
+#include "rng.hh"
 
 #include <H5Cpp.h>
 
 #include <R.h>
 #include <Rinternals.h>
 
+#include <fml/src/fml/cpu/cpumat.hh>
+#include <fml/src/fml/cpu/cpuvec.hh>
+#include <fml/src/fml/cpu/linalg/qr.hh>
+
 
 template <typename T>
 static inline T dot(const hsize_t n, const T *x, const T *y)
@@ -46,21 +51,56 @@ static inline void alloc(const hsize_t n, const int k, T **alpha, T **beta, T **
 
 
 
+// Random start vectors from the counter-based generator, so they depend only
+// on the seed.
 template <typename T>
-static inline void initialize(const hsize_t n, const int k, T *q)
+static inline void initialize(const hsize_t n, const int k, T *q,
+  const uint64_t seed)
 {
   std::memset(q, 0, n*k*sizeof(*q));
-  GetRNGstate();
   
+  #pragma omp parallel for simd if(n > OMP_MIN_LEN)
   for (hsize_t i=0; i<n; i++)
-    q[i] = (T)unif_rand();
+    q[i] = (T)rng_unif(seed, RNG_STREAM_START, i);
   
   T l2 = l2norm(n, q);
   #pragma omp parallel for simd if(n > OMP_MIN_LEN)
   for (hsize_t i=0; i<n; i++)
     q[i] /= l2;
+}
+
+
+
+template <typename T>
+static inline void initialize_block(const hsize_t n, const int b, T *Q,
+  const uint64_t seed)
+{
+  #pragma omp parallel for simd if(n*b > OMP_MIN_LEN)
+  for (hsize_t i=0; i<n*b; i++)
+    Q[i] = (T)rng_unif(seed, RNG_STREAM_START, i);
+}
+
+
+
+// Q = qr.Q(X) and optionally R = qr.R(X) for column-major n x b X
+template <typename T>
+static inline void orthonormalize(const hsize_t n, const int b, T *X, T *Q,
+  T *R)
+{
+  fml::cpumat<T> X_mat(X, n, b, false);
+  fml::cpuvec<T> qraux, work;
+  fml::linalg::qr(false, X_mat, qraux);
+  
+  if (R != NULL)
+  {
+    fml::cpumat<T> R_mat;
+    fml::linalg::qr_R(X_mat, R_mat);
+    std::memcpy(R, R_mat.data_ptr(), b*b*sizeof(*R));
+  }
   
-  PutRNGstate();
+  fml::cpumat<T> Q_mat;
+  fml::linalg::qr_Q(X_mat, qraux, Q_mat, work);
+  std::memcpy(Q, Q_mat.data_ptr(), n*b*sizeof(*Q));
 }
 
 
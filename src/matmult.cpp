@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <float/float32.h>
+
+#include "hdfmat.h"
+#include "extptr.h"
+#include "omp.h"
+#include "panel.hh"
+#include "types.h"
+
+
+// Y = A*X (m x b) or t(A)*X (n x b), in memory
+template <typename T>
+static inline void matmult(const hsize_t m, const hsize_t n, const int b,
+  const T *X, T *Y, const bool trans, const double mem, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  if (trans)
+    panel_matmult_t(m, n, b, X, Y, mem, storage, dataset, h5type);
+  else
+    panel_matmult(m, n, b, X, Y, mem, storage, dataset, h5type);
+}
+
+extern "C" SEXP R_hdfmat_matmult(SEXP m_, SEXP n_, SEXP ds, SEXP x,
+  SEXP trans_, SEXP type, SEXP storage, SEXP mem_)
+{
+  SEXP ret;
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
+  
+  const hsize_t m = (hsize_t) DBL(m_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const int b = ncols(x);
+  const bool trans = (bool) LOGICAL(trans_)[0];
+  const double mem = DBL(mem_);
+  const int rows = (int) (trans ? n : m);
+  
+  if (INT(type) == TYPE_DOUBLE)
+  {
+    PROTECT(ret = allocMatrix(REALSXP, rows, b));
+    TRY_CATCH( matmult(m, n, b, REAL(x), REAL(ret), trans, mem, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
+  }
+  else // if (INT(type) == TYPE_FLOAT)
+  {
+    PROTECT(ret = allocMatrix(INTSXP, rows, b));
+    TRY_CATCH( matmult(m, n, b, FLOAT(x), FLOAT(ret), trans, mem, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
+  }
+  
+  stats_end(st);
+  UNPROTECT(1);
+  return ret;
+}
+
+
+
+// Same products written to the dataset out. With a full A and no transpose,
+// row panel j of A gives rows j of the result, so its band t(X)*t(A_p) goes
+// back into the panel's buffer and the stream writes it out while the next
+// panel is read; only a band of the result is ever in memory, and all I/O
+// stays on the one stream thread. Otherwise every panel updates every row of
+// the result, which is formed in memory and then written.
+template <typename T>
+static inline void matmult_ooc(const hsize_t m, const hsize_t n, const int b,
+  const T *X, const bool trans, const double mem, const int storage,
+  H5::DataSet *dataset, H5::DataSet *dataset_out, H5::PredType h5type)
+{
+  if (trans || storage == STORAGE_SYM)
+  {
+    const hsize_t rows = trans ? n : m;
+    T *Y = panel_alloc<T>(rows, b);
+    matmult(m, n, b, X, Y, trans, mem, storage, dataset, h5type);
+    write_colmajor<T>((hsize_t)0, rows, (hsize_t)b, Y, rows, STORAGE_FULL, dataset_out, h5type);
+    std::free(Y);
+    return;
+  }
+  
+  const hsize_t len = std::max(n, (hsize_t)b);
+  const hsize_t nr = panel_rows_stored(m, len, sizeof(T), mem/2, STORAGE_FULL, dataset);
+  
+  panel_stream<T> s(m, nr, len,
+    [&](hsize_t j, hsize_t rows, T *x) {
+      read_panel(j, rows, (hsize_t)0, n, x, dataset, h5type);
+    },
+    [&](hsize_t j, hsize_t rows, const T *y) {
+      write_panel(j, rows, (hsize_t)0, (hsize_t)b, y, dataset_out, h5type);
+    }
+  );
+  
+  T *band = panel_alloc<T>(nr, b);
+  
+  for (hsize_t j=0; j<m; j+=nr)
+  {
+    const int rows = (int) std::min(nr, m-j);
+    T *A_p = s.next();
+    fml::blas::gemm('T', 'N', b, rows, (int)n, (T)1, X, (int)n, A_p, (int)n, (T)0, band, b);
+    std::memcpy(A_p, band, (size_t)rows*b * sizeof(*band));
+  }
+  
+  s.finish();
+  std::free(band);
+}
+
+extern "C" SEXP R_hdfmat_matmult_ooc(SEXP m_, SEXP n_, SEXP ds, SEXP x,
+  SEXP trans_, SEXP type, SEXP storage, SEXP mem_, SEXP ds_out)
+{
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  H5::DataSet *dataset_out = (H5::DataSet*) getRptr(ds_out);
+  io_stats *st = stats_begin(dataset);
+  
+  const hsize_t m = (hsize_t) DBL(m_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const int b = ncols(x);
+  const bool trans = (bool) LOGICAL(trans_)[0];
+  const double mem = DBL(mem_);
+  
+  if (INT(type) == TYPE_DOUBLE)
+  {
+    TRY_CATCH( matmult_ooc(m, n, b, REAL(x), trans, mem, INT(storage), dataset, dataset_out, H5::PredType::IEEE_F64LE) );
+  }
+  else // if (INT(type) == TYPE_FLOAT)
+  {
+    TRY_CATCH( matmult_ooc(m, n, b, FLOAT(x), trans, mem, INT(storage), dataset, dataset_out, H5::PredType::IEEE_F32LE) );
+  }
+  
+  stats_end(st);
+  return R_NilValue;
+}
@@ -0,0 +1,165 @@
+#ifndef HDFMAT_MMAP_H
+#define HDFMAT_MMAP_H
+#pragma once
+
+
+#include <string>
+
+#include <H5Cpp.h>
+
+#include "stats.hh"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Read-only memory map of the raw data of a dataset. An unfiltered contiguous
+// dataset in the native format is just an m x n row-major array at a fixed
+// offset of the file, so kernels that only read it can use its pages in place
+// instead of copying them out through hyperslab selections. For anything else
+// (chunked layouts, type conversion, storage not yet allocated, file drivers
+// other than the default one, Windows) nothing is mapped and data() is NULL,
+// and callers read through HDF5 as usual.
+//
+// Kernels report the bytes they use through used(), for stats().
+//
+// The file is flushed first so that raw data still buffered by HDF5 is in the
+// file. A map is made per kernel call and is only valid while the dataset is
+// not written to.
+class dataset_map
+{
+  public:
+    dataset_map(H5::DataSet *dataset, H5::PredType h5type,
+      const bool sequential=true);
+    ~dataset_map();
+    
+    const void* data() const {return base;};
+    template <typename T> const T* rows() const {return (const T*) base;};
+    hsize_t nrows() const {return dims[0];};
+    hsize_t ncols() const {return dims[1];};
+    void used(const double bytes) const {if (base != NULL) stats_mapped(ds, bytes);};
+  
+  private:
+    const H5::DataSet *ds;
+    const void *base;
+    void *addr;
+    size_t len;
+    hsize_t dims[2];
+    
+    void map(H5::DataSet *dataset, H5::PredType h5type, const bool sequential);
+};
+
+
+
+inline dataset_map::dataset_map(H5::DataSet *dataset, H5::PredType h5type,
+  const bool sequential)
+: ds(dataset), base(NULL), addr(NULL), len(0)
+{
+  dims[0] = dims[1] = 0;
+  
+  try
+  {
+    map(dataset, h5type, sequential);
+  }
+  catch (...)
+  {
+    base = NULL;
+  }
+}
+
+
+
+inline dataset_map::~dataset_map()
+{
+#ifndef _WIN32
+  if (addr != NULL)
+    munmap(addr, len);
+#endif
+}
+
+
+
+inline void dataset_map::map(H5::DataSet *dataset, H5::PredType h5type,
+  const bool sequential)
+{
+#ifndef _WIN32
+  H5::DSetCreatPropList plist = dataset->getCreatePlist();
+  if (plist.getLayout() != H5D_CONTIGUOUS || plist.getExternalCount() > 0)
+    return;
+  
+  // the file holds exactly the in-memory representation
+  H5::DataType datatype = dataset->getDataType();
+  if (!(datatype == h5type))
+    return;
+  if (!(datatype == H5::PredType::NATIVE_DOUBLE || datatype == H5::PredType::NATIVE_FLOAT))
+    return;
+  
+  const hid_t ds_id = dataset->getId();
+  haddr_t offset = HADDR_UNDEF;
+  H5E_BEGIN_TRY { offset = H5Dget_offset(ds_id); } H5E_END_TRY;
+  if (offset == HADDR_UNDEF)
+    return;
+  
+  const hid_t file_id = H5Iget_file_id(ds_id);
+  if (file_id < 0)
+    return;
+  
+  const hid_t fapl = H5Fget_access_plist(file_id);
+  const bool sec2 = (fapl >= 0 && H5Pget_driver(fapl) == H5FD_SEC2);
+  const herr_t flushed = H5Fflush(file_id, H5F_SCOPE_LOCAL);
+  
+  if (fapl >= 0)
+    H5Pclose(fapl);
+  H5Fclose(file_id);
+  if (!sec2 || flushed < 0)
+    return;
+  
+  dataset->getSpace().getSimpleExtentDims(dims, NULL);
+  const size_t bytes = (size_t) (dims[0]*dims[1] * datatype.getSize());
+  if (bytes == 0)
+    return;
+  
+  // the offset is from the start of the file, user block included; mmap
+  // offsets are page aligned
+  const off_t start = (off_t) offset;
+  const off_t page = (off_t) sysconf(_SC_PAGESIZE);
+  const off_t aligned = start / page * page;
+  
+  const std::string filename = dataset->getFileName();
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (off_t)(start + bytes) > st.st_size)
+  {
+    close(fd);
+    return;
+  }
+  
+  len = bytes + (size_t) (start - aligned);
+  void *p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, aligned);
+  close(fd);
+  if (p == MAP_FAILED)
+    return;
+  
+  // the kernel's read-ahead takes the place of the background reads
+  if (sequential)
+    madvise(p, len, MADV_SEQUENTIAL);
+  
+  addr = p;
+  base = (const char*) p + (start - aligned);
+  stats_map(dataset);
+#else
+  (void) dataset;
+  (void) h5type;
+  (void) sequential;
+#endif
+}
+
+
+#endif
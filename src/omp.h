@@ -3,7 +3,28 @@
 #pragma once
 
 
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
 #define OMP_MIN_LEN 1000
 
 
+// threads for a parallel region; a panel_stream thread, whose I/O overlaps
+// the compute of the R thread (and its OpenMP and BLAS threads), gets half
+static inline int omp_threads(const bool stream)
+{
+#ifdef _OPENMP
+  const int nt = omp_get_max_threads();
+  return stream ? std::max(1, nt/2) : nt;
+#else
+  (void) stream;
+  return 1;
+#endif
+}
+
+
 #endif
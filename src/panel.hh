@@ -0,0 +1,571 @@
+#ifndef HDFMAT_PANEL_H
+#define HDFMAT_PANEL_H
+#pragma once
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <H5Cpp.h>
+
+#include <fml/src/fml/cpu/linalg/crossprod.hh>
+
+#include "chunks.hh"
+#include "compact.hh"
+#include "mmap.hh"
+#include "omp.h"
+#include "stats.hh"
+#include "stream.hh"
+#include "types.h"
+
+
+// Number of rows of an m x n matrix with elements of the given size that fit
+// in a memory budget of mem MiB. Always at least 1 and at most m.
+static inline hsize_t panel_rows(const hsize_t m, const hsize_t n,
+  const size_t size, const double mem)
+{
+  const double bytes = mem * 1024.0 * 1024.0;
+  const double row_bytes = (double) n * size;
+  
+  hsize_t rows = (hsize_t) (bytes / row_bytes);
+  if (rows < 1)
+    rows = 1;
+  else if (rows > m)
+    rows = m;
+  
+  return rows;
+}
+
+
+
+template <typename T>
+static inline T* panel_alloc(const hsize_t rows, const hsize_t n)
+{
+  T *x = (T*) std::malloc(rows*n * sizeof(*x));
+  if (x == NULL)
+    throw std::bad_alloc();
+  
+  return x;
+}
+
+
+
+// read/write the rows x cols block at (row_start, col_start); x is row-major
+template <typename T>
+static inline void read_panel(const hsize_t row_start, const hsize_t rows,
+  const hsize_t col_start, const hsize_t cols, T *x, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+  // compact types are decoded here (see compact.hh), and deflated chunks are
+  // inflated on all cores where possible (see chunks.hh)
+  const double t = stats_clock();
+  const double compact = read_compact(row_start, rows, col_start, cols, x, dataset);
+  if (compact > 0)
+  {
+    stats_io(dataset, false, compact, stats_clock() - t);
+    return;
+  }
+  else if (read_chunks(row_start, rows, col_start, cols, x, dataset, h5type))
+  {
+    stats_io(dataset, false, (double) rows*cols * sizeof(T), stats_clock() - t);
+    return;
+  }
+  
+  hsize_t slice[2];
+  slice[0] = rows;
+  slice[1] = cols;
+  
+  H5::DataSpace mem_space(2, slice, NULL);
+  H5::DataSpace data_space = dataset->getSpace();
+  
+  hsize_t offset[2];
+  offset[0] = row_start;
+  offset[1] = col_start;
+  
+  data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
+  dataset->read(x, h5type, mem_space, data_space);
+  stats_io(dataset, false, (double) rows*cols * sizeof(T), stats_clock() - t);
+}
+
+template <typename T>
+static inline void write_panel(const hsize_t row_start, const hsize_t rows,
+  const hsize_t col_start, const hsize_t cols, const T *x,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  // compact types are encoded here, and whole deflated chunks are compressed
+  // on all cores where possible
+  const double t = stats_clock();
+  const double compact = write_compact(row_start, rows, col_start, cols, x, cols, dataset);
+  if (compact > 0)
+  {
+    stats_io(dataset, true, compact, stats_clock() - t);
+    return;
+  }
+  else if (write_chunks(row_start, rows, col_start, cols, x, cols, dataset, h5type))
+  {
+    stats_io(dataset, true, (double) rows*cols * sizeof(T), stats_clock() - t);
+    return;
+  }
+  
+  hsize_t slice[2];
+  slice[0] = rows;
+  slice[1] = cols;
+  
+  H5::DataSpace mem_space(2, slice, NULL);
+  H5::DataSpace data_space = dataset->getSpace();
+  
+  hsize_t offset[2];
+  offset[0] = row_start;
+  offset[1] = col_start;
+  
+  data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
+  dataset->write(x, h5type, mem_space, data_space);
+  stats_io(dataset, true, (double) rows*cols * sizeof(T), stats_clock() - t);
+}
+
+
+
+// Symmetric storage keeps only the chunks on and above the diagonal, so row i
+// holds columns from the start of its tile to n. The diagonal tiles are
+// stored in full.
+static inline hsize_t sym_tile(H5::DataSet *dataset)
+{
+  hsize_t dim_chunk[2];
+  dataset->getCreatePlist().getChunk(2, dim_chunk);
+  return dim_chunk[0];
+}
+
+static inline hsize_t sym_col_start(const hsize_t i, const hsize_t t)
+{
+  return (i / t) * t;
+}
+
+// rows per chunk, or 1 if the dataset is not chunked
+static inline hsize_t chunk_rows(H5::DataSet *dataset)
+{
+  H5::DSetCreatPropList plist = dataset->getCreatePlist();
+  if (plist.getLayout() != H5D_CHUNKED)
+    return 1;
+  
+  hsize_t dim_chunk[2];
+  plist.getChunk(2, dim_chunk);
+  return dim_chunk[0];
+}
+
+
+
+// read_panel() for symmetric storage; strictly lower values are taken from
+// the mirrored blocks, a tile at a time, so the only memory beyond x is one
+// tile whatever the panel size
+template <typename T>
+static inline void read_panel_sym(const hsize_t row_start, const hsize_t rows,
+  const hsize_t col_start, const hsize_t cols, T *x, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+  read_panel(row_start, rows, col_start, cols, x, dataset, h5type);
+  if (row_start + rows - 1 <= col_start)
+    return;
+  
+  const hsize_t t = sym_tile(dataset);
+  const hsize_t row_stop = row_start + rows;
+  const hsize_t col_stop = std::min(col_start + cols, row_stop - 1);
+  T *x_t = panel_alloc<T>(t, t);
+  
+  // x_t holds the block of rows [jb, je) and columns [ib, ie)
+  for (hsize_t jb=col_start; jb<col_stop; jb=(jb/t + 1)*t)
+  {
+    const hsize_t je = std::min((jb/t + 1)*t, col_stop);
+    for (hsize_t ib=row_start; ib<row_stop; ib=(ib/t + 1)*t)
+    {
+      const hsize_t ie = std::min((ib/t + 1)*t, row_stop);
+      if (jb + 1 >= ie)
+        continue;
+      
+      try
+      {
+        read_panel(jb, je-jb, ib, ie-ib, x_t, dataset, h5type);
+      }
+      catch (...)
+      {
+        std::free(x_t);
+        throw;
+      }
+      
+      for (hsize_t i=ib; i<ie; i++)
+      {
+        for (hsize_t j=jb; j<je && j<i; j++)
+          x[(j-col_start) + cols*(i-row_start)] = x_t[(i-ib) + (ie-ib)*(j-jb)];
+      }
+    }
+  }
+  
+  std::free(x_t);
+}
+
+// write the stored part of the rows x (n - col_start) block x at
+// (row_start, col_start); col_start must be at most the start of the first
+// row's tile. Like write_panel(), tile rows of a compact dataset are encoded
+// here, and the others are written as whole deflated chunks where possible.
+template <typename T>
+static inline void write_panel_sym(const hsize_t row_start, const hsize_t rows,
+  const hsize_t col_start, const hsize_t n, const T *x, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+  const hsize_t t = sym_tile(dataset);
+  const hsize_t row_stop = row_start + rows;
+  
+  hsize_t dim[2];
+  dim[0] = rows;
+  dim[1] = n - col_start;
+  
+  H5::DataSpace mem_space(2, dim, NULL);
+  H5::DataSpace data_space = dataset->getSpace();
+  
+  hsize_t slice[2], mem_offset[2], offset[2];
+  
+  for (hsize_t i=row_start; i<row_stop; )
+  {
+    const hsize_t c = sym_col_start(i, t);
+    const hsize_t i_stop = std::min(c + t, row_stop);
+    
+    slice[0] = i_stop - i;
+    slice[1] = n - c;
+    mem_offset[0] = i - row_start;
+    mem_offset[1] = c - col_start;
+    offset[0] = i;
+    offset[1] = c;
+    
+    const double t0 = stats_clock();
+    const T *x_i = x + mem_offset[0]*dim[1] + mem_offset[1];
+    double bytes = write_compact(i, slice[0], c, slice[1], x_i, dim[1], dataset);
+    if (bytes == 0)
+    {
+      bytes = (double) slice[0]*slice[1] * sizeof(T);
+      if (!write_chunks(i, slice[0], c, slice[1], x_i, dim[1], dataset, h5type))
+      {
+        mem_space.selectHyperslab(H5S_SELECT_SET, slice, mem_offset);
+        data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
+        dataset->write(x, h5type, mem_space, data_space);
+      }
+    }
+    
+    stats_io(dataset, true, bytes, stats_clock() - t0);
+    
+    i = i_stop;
+  }
+}
+
+
+
+// Panels of the stored part of a matrix: rows of the full matrix, or for
+// symmetric storage whole tile rows starting at the diagonal column. x is the
+// row-major rows x (n - c) block at column c = stored_col_start(row_start).
+// Panels cover whole rows of chunks when the budget allows, so each chunk is
+// read (and decompressed) once per pass.
+static inline hsize_t panel_rows_stored(const hsize_t m, const hsize_t n,
+  const size_t size, const double mem, const int storage,
+  H5::DataSet *dataset)
+{
+  hsize_t nr = panel_rows(m, n, size, mem);
+  const hsize_t t = chunk_rows(dataset);
+  if (storage == STORAGE_SYM)
+    nr = std::min(m, std::max(t, nr/t*t));
+  else if (t <= nr)
+    nr = nr/t*t;
+  
+  return nr;
+}
+
+static inline hsize_t stored_col_start(const hsize_t row_start,
+  const int storage)
+{
+  return (storage == STORAGE_SYM) ? row_start : 0;
+}
+
+template <typename T>
+static inline void read_panel_stored(const hsize_t row_start,
+  const hsize_t rows, const hsize_t n, T *x, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  const hsize_t c = stored_col_start(row_start, storage);
+  read_panel(row_start, rows, c, n-c, x, dataset, h5type);
+}
+
+template <typename T>
+static inline void write_panel_stored(const hsize_t row_start,
+  const hsize_t rows, const hsize_t n, const T *x, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  const hsize_t c = stored_col_start(row_start, storage);
+  if (storage == STORAGE_SYM)
+    write_panel_sym(row_start, rows, c, n, x, dataset, h5type);
+  else
+    write_panel(row_start, rows, c, n-c, x, dataset, h5type);
+}
+
+
+
+// read the full rows [row_start, row_start+rows) of an m x n matrix stored
+// with either storage
+template <typename T>
+static inline void read_rows(const hsize_t row_start, const hsize_t rows,
+  const hsize_t n, T *x, const int storage, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+  if (storage == STORAGE_SYM)
+    read_panel_sym(row_start, rows, (hsize_t)0, n, x, dataset, h5type);
+  else
+    read_panel(row_start, rows, (hsize_t)0, n, x, dataset, h5type);
+}
+
+
+
+// y = t(x) for the row-major rows x cols x with leading dimension ldx, i.e.
+// x as the column-major rows x cols y with leading dimension ldy, converting
+// the elements from S to T. The same call turns a column-major x into a
+// row-major y with the dimensions swapped. Goes tile by tile so both sides
+// stay in cache; threads own whole tile columns of y.
+template <typename S, typename T>
+static inline void transpose(const hsize_t rows, const hsize_t cols,
+  const S *x, const hsize_t ldx, T *y, const hsize_t ldy)
+{
+  const double t = stats_clock();
+  
+  #pragma omp parallel for if(rows*cols > OMP_MIN_LEN)
+  for (hsize_t jb=0; jb<cols; jb+=TRANSPOSE_BLOCK)
+  {
+    const hsize_t je = std::min(cols, jb+TRANSPOSE_BLOCK);
+    
+    for (hsize_t ib=0; ib<rows; ib+=TRANSPOSE_BLOCK)
+    {
+      const hsize_t ie = std::min(rows, ib+TRANSPOSE_BLOCK);
+      
+      for (hsize_t j=jb; j<je; j++)
+      {
+        #pragma omp simd
+        for (hsize_t i=ib; i<ie; i++)
+          y[i + ldy*j] = (T) x[j + ldx*i];
+      }
+    }
+  }
+  
+  stats_convert(stats_clock() - t);
+}
+
+
+
+// The len elements of x as T: x itself if it already is, otherwise x
+// converted into buf. Lets kernels read panels in the stored precision S and
+// compute on them in a wider T.
+template <typename T>
+static inline const T* widen(const hsize_t len, const T *x, T *buf)
+{
+  (void) len;
+  (void) buf;
+  return x;
+}
+
+template <typename S, typename T>
+static inline const T* widen(const hsize_t len, const S *x, T *buf)
+{
+  const double t = stats_clock();
+  
+  #pragma omp parallel for simd if(len > OMP_MIN_LEN)
+  for (hsize_t i=0; i<len; i++)
+    buf[i] = (T) x[i];
+  
+  stats_convert(stats_clock() - t);
+  return buf;
+}
+
+// the buffer widen() needs for panels of up to len elements, if any
+template <typename S, typename T>
+static inline T* widen_alloc(const hsize_t len)
+{
+  return (sizeof(S) == sizeof(T)) ? NULL : panel_alloc<T>(len, 1);
+}
+
+// memory budget of each of the two stream buffers of S when a third buffer
+// holds the panel widened to T
+template <typename S, typename T>
+static inline double widen_mem(const double mem)
+{
+  return (sizeof(S) == sizeof(T)) ? mem/2 : mem/(2 + (double)sizeof(T)/sizeof(S));
+}
+
+
+
+// Write the column-major rows x n in-memory matrix X (leading dimension ldx,
+// elements of type S) to the full rows [row_start, row_start+rows) of the
+// dataset. Each panel of rows is transposed and converted to T in a stream
+// buffer and written by the stream thread while the next one is formed, so
+// only the two small buffers are ever allocated.
+template <typename T, typename S>
+static inline void write_colmajor(const hsize_t row_start, const hsize_t rows,
+  const hsize_t n, const S *X, const hsize_t ldx, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  const hsize_t nr = panel_rows_stored(rows, n, sizeof(T), TRANSPOSE_MEM/2, storage, dataset);
+  
+  panel_stream<T> s(rows, nr, n, nullptr,
+    [&](hsize_t i, hsize_t r, const T *x) {
+      if (storage == STORAGE_SYM)
+        write_panel_sym(row_start+i, r, (hsize_t)0, n, x, dataset, h5type);
+      else
+        write_panel(row_start+i, r, (hsize_t)0, n, x, dataset, h5type);
+    }
+  );
+  
+  for (hsize_t i=0; i<rows; i+=nr)
+  {
+    const hsize_t r = std::min(nr, rows-i);
+    T *x = s.next();
+    transpose(n, r, X+i, ldx, x, n);
+  }
+  
+  s.finish();
+}
+
+
+
+// y = beta*y + op(A)*x for column-major m x n A. A row-major p x n panel is a
+// column-major n x p matrix, so panel*x is gemv('T', n, p, ...) and
+// t(panel)*x is gemv('N', n, p, ...). Goes through the gemm binding with a
+// single right-hand column, which optimized BLAS libraries dispatch to gemv.
+template <typename T>
+static inline void gemv(const char trans, const int m, const int n, const T *A,
+  const T *x, const T beta, T *y)
+{
+  if (trans == 'N')
+    fml::blas::gemm('N', 'N', m, 1, n, (T)1, A, m, x, n, beta, y, m);
+  else
+    fml::blas::gemm('T', 'N', n, 1, m, (T)1, A, m, x, m, beta, y, n);
+}
+
+
+
+// Copy the upper triangles of the diagonal tiles of the row-major rows x w
+// panel x, which starts on a tile, into their lower triangles; the stored
+// lower values of a diagonal tile are whatever was written there.
+template <typename T>
+static inline void mirror_diag(const hsize_t rows, const hsize_t w,
+  const hsize_t t, T *x)
+{
+  for (hsize_t d=0; d<rows; d+=t)
+  {
+    const hsize_t b = std::min(t, rows-d);
+    for (hsize_t i=1; i<b; i++)
+    {
+      for (hsize_t j=0; j<i; j++)
+        x[(d+i)*w + d+j] = x[(d+j)*w + d+i];
+    }
+  }
+}
+
+// Y = A*X for symmetric storage. Each tile row of a panel contributes its
+// stored part directly and its strictly upper part transposed, after the
+// diagonal tiles are mirrored. The file holds S, which is widened to T panel
+// by panel.
+template <typename T, typename S=T>
+static inline void panel_matmult_sym(const hsize_t n, const int b, const T *X,
+  T *Y, const double mem, H5::DataSet *dataset, H5::PredType h5type)
+{
+  const hsize_t t = sym_tile(dataset);
+  const hsize_t nr = panel_rows_stored(n, n, sizeof(S), widen_mem<S, T>(mem), STORAGE_SYM, dataset);
+  
+  std::memset(Y, 0, n*b*sizeof(*Y));
+  
+  T *buf = widen_alloc<S, T>(nr*n);
+  panel_stream<S> s(n, nr, n, [&](hsize_t j, hsize_t rows, S *x) {
+    read_panel(j, rows, j, n-j, x, dataset, h5type);
+    mirror_diag(rows, n-j, t, x);
+  });
+  
+  for (hsize_t j=0; j<n; j+=nr)
+  {
+    const hsize_t rows = std::min(nr, n-j);
+    const hsize_t w = n - j;
+    const T *A_p = widen(rows*w, s.next(), buf);
+    
+    for (hsize_t i=j; i<j+rows; i+=t)
+    {
+      const hsize_t rows_i = std::min(t, j+rows-i);
+      const hsize_t rest = n - i - rows_i;
+      const T *A_i = A_p + (i-j)*w + (i-j);
+      
+      fml::blas::gemm('T', 'N', rows_i, b, n-i, (T)1, A_i, w, X+i, n, (T)1, Y+i, n);
+      if (rest > 0)
+        fml::blas::gemm('N', 'N', rest, b, rows_i, (T)1, A_i+rows_i, w, X+i, n, (T)1, Y+i+rows_i, n);
+    }
+  }
+  
+  s.finish();
+  std::free(buf);
+}
+
+
+
+// Y = A*X for the m x n stored matrix A and in-memory column-major n x b X,
+// streamed over row panels of A in one pass. Y is column-major m x b. The
+// budget covers both stream buffers (and the widened panel if the file holds
+// a narrower S than T; h5type is then that of S).
+template <typename T, typename S=T>
+static inline void panel_matmult(const hsize_t m, const hsize_t n, const int b,
+  const T *X, T *Y, const double mem, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  if (storage == STORAGE_SYM)
+    return panel_matmult_sym<T, S>(n, b, X, Y, mem, dataset, h5type);
+  
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(S), widen_mem<S, T>(mem), STORAGE_FULL, dataset);
+  T *buf = widen_alloc<S, T>(nr*n);
+  dataset_map map(dataset, h5type);
+  panel_stream<S> s(m, nr, n, [&](hsize_t j, hsize_t rows, S *x) {
+    read_panel(j, rows, (hsize_t)0, n, x, dataset, h5type);
+  }, map);
+  
+  for (hsize_t j=0; j<m; j+=nr)
+  {
+    const hsize_t rows = std::min(nr, m-j);
+    const T *A_p = widen(rows*n, s.next(), buf);
+    fml::blas::gemm('T', 'N', rows, b, n, (T)1, A_p, n, X, n, (T)0, Y+j, m);
+  }
+  
+  s.finish();
+  std::free(buf);
+}
+
+
+
+// Y = t(A)*X for the m x n stored matrix A and in-memory column-major m x b X,
+// streamed over row panels of A in one pass. Y is column-major n x b.
+template <typename T>
+static inline void panel_matmult_t(const hsize_t m, const hsize_t n,
+  const int b, const T *X, T *Y, const double mem, const int storage,
+  H5::DataSet *dataset, H5::PredType h5type)
+{
+  if (storage == STORAGE_SYM)
+    return panel_matmult_sym(n, b, X, Y, mem, dataset, h5type);
+  
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), mem/2, STORAGE_FULL, dataset);
+  dataset_map map(dataset, h5type);
+  panel_stream<T> s(m, nr, n, [&](hsize_t j, hsize_t rows, T *x) {
+    read_panel(j, rows, (hsize_t)0, n, x, dataset, h5type);
+  }, map);
+  
+  for (hsize_t j=0; j<m; j+=nr)
+  {
+    const hsize_t rows = std::min(nr, m-j);
+    const T *A_p = s.next();
+    
+    const T beta = (j == 0) ? (T)0 : (T)1;
+    fml::blas::gemm('N', 'N', n, b, rows, (T)1, A_p, n, X+j, m, beta, Y, n);
+  }
+  
+  s.finish();
+}
+
+
+#endif
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "omp.h"
+#include "panel.hh"
+
+#include "hdfmat.h"
+#include "extptr.h"
+#include "types.h"
+
+
+// columns per block of the column reductions; each thread owns whole blocks
+#define REDUCE_BLOCK 256
+
+
+// Reductions accumulated over one pass, in double precision whatever the
+// storage type. With symmetric storage only elements on and above the
+// diagonal are visited and their mirror images are accounted for, so the row
+// and column reductions agree.
+struct reductions
+{
+  double *rsum;
+  double *rssq;
+  double *csum;
+  double *cssq;
+  double min;
+  double max;
+  double trace;
+};
+
+
+
+// Row reductions, min/max, and trace of the rows x w panel x holding rows
+// [i, i+rows) and columns [c, n) of the matrix.
+template <typename T>
+static inline void reduce_rows(const int what, const hsize_t i,
+  const hsize_t rows, const hsize_t c, const hsize_t w, const T *x,
+  const int storage, reductions *r)
+{
+  double mn = r->min;
+  double mx = r->max;
+  double tr = 0;
+  
+  #pragma omp parallel for reduction(min:mn) reduction(max:mx) reduction(+:tr) if(rows*w > OMP_MIN_LEN)
+  for (hsize_t k=0; k<rows; k++)
+  {
+    // skip the stored elements below the diagonal for symmetric storage
+    const hsize_t first = (storage == STORAGE_SYM) ? (i+k) - c : 0;
+    const T *x_k = x + k*w;
+    
+    double s = 0, q = 0;
+    double mn_k = mn, mx_k = mx;
+    #pragma omp simd reduction(+:s,q) reduction(min:mn_k) reduction(max:mx_k)
+    for (hsize_t j=first; j<w; j++)
+    {
+      const double v = (double) x_k[j];
+      s += v;
+      q += v*v;
+      mn_k = std::min(mn_k, v);
+      mx_k = std::max(mx_k, v);
+    }
+    
+    if (what & REDUCE_ROWS)
+    {
+      r->rsum[i+k] = s;
+      r->rssq[i+k] = q;
+    }
+    
+    mn = std::min(mn, mn_k);
+    mx = std::max(mx, mx_k);
+    
+    if ((what & REDUCE_TRACE) && i+k >= c && i+k-c < w)
+      tr += (double) x_k[i+k-c];
+  }
+  
+  r->min = mn;
+  r->max = mx;
+  r->trace += tr;
+}
+
+
+
+// Column reductions of the same panel. Threads split the columns so every
+// accumulator has one owner; with symmetric storage only the strictly upper
+// elements are added, as the mirrored row contributions.
+template <typename T>
+static inline void reduce_cols(const hsize_t i, const hsize_t rows,
+  const hsize_t c, const hsize_t w, const T *x, const int storage,
+  double *csum, double *cssq)
+{
+  #pragma omp parallel for if(rows*w > OMP_MIN_LEN)
+  for (hsize_t jb=0; jb<w; jb+=REDUCE_BLOCK)
+  {
+    const hsize_t je = std::min(w, jb+REDUCE_BLOCK);
+    
+    for (hsize_t k=0; k<rows; k++)
+    {
+      const T *x_k = x + k*w;
+      const hsize_t first = (storage == STORAGE_SYM) ? std::max(jb, (i+k) - c + 1) : jb;
+      
+      #pragma omp simd
+      for (hsize_t j=first; j<je; j++)
+      {
+        const double v = (double) x_k[j];
+        csum[c+j] += v;
+        cssq[c+j] += v*v;
+      }
+    }
+  }
+}
+
+
+
+template <typename T>
+static inline void reduce(const int what, const hsize_t m, const hsize_t n,
+  reductions *r, const int storage, H5::DataSet *dataset, H5::PredType h5type)
+{
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), STREAM_MEM/2, storage, dataset);
+  const bool cols = (what & REDUCE_COLS) || (storage == STORAGE_SYM && (what & REDUCE_ROWS));
+  
+  // symmetric storage is chunked, so never mapped
+  dataset_map map(dataset, h5type);
+  panel_stream<T> s(m, nr, n, [&](hsize_t i, hsize_t rows, T *x) {
+    read_panel_stored(i, rows, n, x, storage, dataset, h5type);
+  }, map);
+  
+  for (hsize_t i=0; i<m; i+=nr)
+  {
+    const hsize_t rows = std::min(nr, m-i);
+    const hsize_t c = stored_col_start(i, storage);
+    const T *x = s.next();
+    
+    reduce_rows(what, i, rows, c, n-c, x, storage, r);
+    if (cols)
+      reduce_cols(i, rows, c, n-c, x, storage, r->csum, r->cssq);
+  }
+  
+  s.finish();
+  
+  // symmetric: the strictly upper column sums are the missing lower parts of
+  // the row sums, and column sums equal row sums
+  if (storage == STORAGE_SYM && cols)
+  {
+    for (hsize_t j=0; j<n; j++)
+    {
+      r->rsum[j] += r->csum[j];
+      r->rssq[j] += r->cssq[j];
+    }
+    
+    std::memcpy(r->csum, r->rsum, n*sizeof(double));
+    std::memcpy(r->cssq, r->rssq, n*sizeof(double));
+  }
+}
+
+extern "C" SEXP R_hdfmat_reduce(SEXP m_, SEXP n_, SEXP ds, SEXP what_,
+  SEXP type, SEXP storage_)
+{
+  SEXP ret, rsum, rssq, csum, cssq, min, max, trace;
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
+  
+  const hsize_t m = (hsize_t) DBL(m_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const int what = INT(what_);
+  const int storage = INT(storage_);
+  
+  // symmetric row sums are finished with the column accumulators
+  const bool need_rows = (what & REDUCE_ROWS) || (storage == STORAGE_SYM && (what & REDUCE_COLS));
+  const bool need_cols = (what & REDUCE_COLS) || (storage == STORAGE_SYM && (what & REDUCE_ROWS));
+  
+  PROTECT(rsum = allocVector(REALSXP, need_rows ? m : 0));
+  PROTECT(rssq = allocVector(REALSXP, need_rows ? m : 0));
+  PROTECT(csum = allocVector(REALSXP, need_cols ? n : 0));
+  PROTECT(cssq = allocVector(REALSXP, need_cols ? n : 0));
+  PROTECT(min = allocVector(REALSXP, 1));
+  PROTECT(max = allocVector(REALSXP, 1));
+  PROTECT(trace = allocVector(REALSXP, 1));
+  
+  std::memset(REAL(csum), 0, LENGTH(csum)*sizeof(double));
+  std::memset(REAL(cssq), 0, LENGTH(cssq)*sizeof(double));
+  
+  reductions r;
+  r.rsum = REAL(rsum);
+  r.rssq = REAL(rssq);
+  r.csum = REAL(csum);
+  r.cssq = REAL(cssq);
+  r.min = HUGE_VAL;
+  r.max = -HUGE_VAL;
+  r.trace = 0;
+  
+  const int w = need_rows ? (what | REDUCE_ROWS) : what;
+  
+  if (INT(type) == TYPE_DOUBLE)
+  {
+    TRY_CATCH( reduce<double>(w, m, n, &r, storage, dataset, H5::PredType::IEEE_F64LE) );
+  }
+  else // if (INT(type) == TYPE_FLOAT)
+  {
+    TRY_CATCH( reduce<float>(w, m, n, &r, storage, dataset, H5::PredType::IEEE_F32LE) );
+  }
+  
+  REAL(min)[0] = r.min;
+  REAL(max)[0] = r.max;
+  REAL(trace)[0] = r.trace;
+  
+  PROTECT(ret = allocVector(VECSXP, 7));
+  SET_VECTOR_ELT(ret, 0, rsum);
+  SET_VECTOR_ELT(ret, 1, rssq);
+  SET_VECTOR_ELT(ret, 2, csum);
+  SET_VECTOR_ELT(ret, 3, cssq);
+  SET_VECTOR_ELT(ret, 4, min);
+  SET_VECTOR_ELT(ret, 5, max);
+  SET_VECTOR_ELT(ret, 6, trace);
+  
+  stats_end(st);
+  UNPROTECT(8);
+  return ret;
+}
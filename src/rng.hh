@@ -0,0 +1,100 @@
+#ifndef HDFMAT_RNG_H
+#define HDFMAT_RNG_H
+#pragma once
+
+
+#include <cmath>
+#include <cstdint>
+
+
+// Independent streams of the generator for the same seed, so that e.g. the
+// Lanczos start vector is not a copy of the first row of a runif fill.
+#define RNG_STREAM_FILL   0
+#define RNG_STREAM_START  1
+#define RNG_STREAM_SKETCH 2
+
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3", SC11). A counter-based generator has no state: the random words for a
+// counter are a pure function of the counter and the key, so element i of a
+// matrix is always generated from counter i no matter which thread, panel, or
+// pass produces it.
+struct philox4x32
+{
+  uint32_t v[4];
+};
+
+
+
+static inline uint32_t mulhilo32(const uint32_t a, const uint32_t b, uint32_t *hi)
+{
+  const uint64_t p = (uint64_t)a * b;
+  *hi = (uint32_t) (p >> 32);
+  return (uint32_t) p;
+}
+
+
+
+static inline philox4x32 philox(const uint64_t ctr, const uint32_t stream,
+  const uint64_t seed)
+{
+  uint32_t c0 = (uint32_t) ctr;
+  uint32_t c1 = (uint32_t) (ctr >> 32);
+  uint32_t c2 = stream;
+  uint32_t c3 = 0;
+  uint32_t k0 = (uint32_t) seed;
+  uint32_t k1 = (uint32_t) (seed >> 32);
+  
+  for (int r=0; r<10; r++)
+  {
+    uint32_t hi0, hi1;
+    const uint32_t lo0 = mulhilo32(0xD2511F53, c0, &hi0);
+    const uint32_t lo1 = mulhilo32(0xCD9E8D57, c2, &hi1);
+    
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    
+    k0 += 0x9E3779B9;
+    k1 += 0xBB67AE85;
+  }
+  
+  philox4x32 ret = {{c0, c1, c2, c3}};
+  return ret;
+}
+
+
+
+// 53-bit uniform on the open interval (0, 1) from two words
+static inline double rng_u01(const uint32_t a, const uint32_t b)
+{
+  return ((double)(a >> 5) * 67108864.0 + (double)(b >> 6) + 0.5) * (1.0/9007199254740992.0);
+}
+
+
+
+// Uniform (0, 1) value number i of the stream.
+static inline double rng_unif(const uint64_t seed, const uint32_t stream,
+  const uint64_t i)
+{
+  const philox4x32 r = philox(i, stream, seed);
+  return rng_u01(r.v[0], r.v[1]);
+}
+
+
+
+// Standard normal value number i of the stream (Box-Muller on the two
+// uniforms of the same counter).
+static inline double rng_norm(const uint64_t seed, const uint32_t stream,
+  const uint64_t i)
+{
+  const philox4x32 r = philox(i, stream, seed);
+  const double u1 = rng_u01(r.v[0], r.v[1]);
+  const double u2 = rng_u01(r.v[2], r.v[3]);
+  
+  return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+
+#endif
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cstring>
+
+#include "lanczos.hh"
+#include "omp.h"
+#include "panel.hh"
+#include "rng.hh"
+
+#include <fml/src/fml/cpu/cpumat.hh>
+#include <fml/src/fml/cpu/cpuvec.hh>
+#include <fml/src/fml/cpu/linalg/eigen.hh>
+#include <fml/src/fml/cpu/linalg/svd.hh>
+
+#include "hdfmat.h"
+#include "extptr.h"
+#include "types.h"
+
+
+template <typename T>
+static inline void gaussian(const hsize_t len, T *x, const uint64_t seed)
+{
+  #pragma omp parallel for simd if(len > OMP_MIN_LEN)
+  for (hsize_t i=0; i<len; i++)
+    x[i] = (T)rng_norm(seed, RNG_STREAM_SKETCH, i);
+}
+
+
+
+// Randomized range finder with a fixed number of passes over A. The passes
+// alternate between A and t(A) and always end with t(A), so the sketch starts
+// on whichever side makes that work out; passes=2 is the plain
+// Halko-Martinsson-Tropp algorithm and every 2 more passes add one power
+// iteration.
+template <typename T>
+static inline void rsvd(const hsize_t m, const hsize_t n, const int k,
+  const int l, const int passes, T *values, const uint64_t seed,
+  const double mem, const int storage, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+  const hsize_t len = std::max(m, n);
+  T *X = (T*) std::malloc(len*l * sizeof(*X));
+  T *Y = (T*) std::malloc(len*l * sizeof(*Y));
+  
+  // an A pass needs n x l input, a t(A) pass m x l input
+  bool trans = (passes % 2 == 1);
+  gaussian((trans ? m : n) * l, X, seed);
+  
+  for (int p=0; p<passes; p++)
+  {
+    if (trans)
+    {
+      panel_matmult_t(m, n, l, X, Y, mem, storage, dataset, h5type);
+      if (p < passes-1)
+        orthonormalize(n, l, Y, X, (T*)NULL);
+    }
+    else
+    {
+      panel_matmult(m, n, l, X, Y, mem, storage, dataset, h5type);
+      orthonormalize(m, l, Y, X, (T*)NULL);
+    }
+    
+    trans = !trans;
+  }
+  
+  std::free(X);
+  
+  // Y = t(A)*Q = t(B) is n x l and has the same singular values as A
+  fml::cpumat<T> Bt(Y, n, l, false);
+  fml::cpuvec<T> s;
+  fml::linalg::svd(Bt, s);
+  std::free(Y);
+  
+  const T *s_d = s.data_ptr();
+  for (int i=0; i<k; i++)
+    values[i] = s_d[i];
+}
+
+extern "C" SEXP R_hdfmat_rsvd(SEXP k_, SEXP l_, SEXP passes_, SEXP m_,
+  SEXP n_, SEXP ds, SEXP type, SEXP storage_, SEXP mem_, SEXP seed_)
+{
+  SEXP values;
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
+  
+  const int k = INT(k_);
+  const int l = INT(l_);
+  const int passes = INT(passes_);
+  const hsize_t m = (hsize_t) DBL(m_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const int storage = INT(storage_);
+  const double mem = DBL(mem_);
+  const uint64_t seed = (uint64_t) DBL(seed_);
+  
+  if (INT(type) == TYPE_DOUBLE)
+  {
+    PROTECT(values = allocVector(REALSXP, k));
+    TRY_CATCH( rsvd(m, n, k, l, passes, REAL(values), seed, mem, storage, dataset, H5::PredType::IEEE_F64LE) );
+  }
+  else // if (INT(type) == TYPE_FLOAT)
+  {
+    PROTECT(values = allocVector(INTSXP, k));
+    TRY_CATCH( rsvd(m, n, k, l, passes, FLOAT(values), seed, mem, storage, dataset, H5::PredType::IEEE_F32LE) );
+  }
+  
+  stats_end(st);
+  UNPROTECT(1);
+  return values;
+}
+
+
+
+// Symmetric variant: the first pass sketches Y = A*Omega, each further pass
+// but the last is a power iteration, and the last forms t(Q)*A*Q.
+template <typename T>
+static inline void reigen_sym(const hsize_t n, const int k, const int l,
+  const int passes, T *values, const uint64_t seed, const double mem,
+  const int storage, H5::DataSet *dataset, H5::PredType h5type)
+{
+  T *Q = (T*) std::malloc(n*l * sizeof(*Q));
+  T *Y = (T*) std::malloc(n*l * sizeof(*Y));
+  
+  gaussian(n*l, Q, seed);
+  
+  for (int p=0; p<passes-1; p++)
+  {
+    panel_matmult(n, n, l, Q, Y, mem, storage, dataset, h5type);
+    orthonormalize(n, l, Y, Q, (T*)NULL);
+  }
+  
+  // T = t(Q)*A*Q
+  panel_matmult(n, n, l, Q, Y, mem, storage, dataset, h5type);
+  
+  T *td = (T*) std::malloc(l*l * sizeof(*td));
+  fml::blas::gemm('T', 'N', l, l, n, (T)1, Q, n, Y, n, (T)0, td, l);
+  std::free(Q);
+  std::free(Y);
+  
+  fml::cpumat<T> td_mat(td, l, l, false);
+  fml::cpuvec<T> values_vec(l);
+  fml::linalg::eigen_sym(td_mat, values_vec);
+  std::free(td);
+  
+  values_vec.rev();
+  const T *values_l = values_vec.data_ptr();
+  for (int i=0; i<k; i++)
+    values[i] = values_l[i] < 0 ? 0 : values_l[i];
+}
+
+extern "C" SEXP R_hdfmat_reigen_sym(SEXP k_, SEXP l_, SEXP passes_, SEXP n_,
+  SEXP ds, SEXP type, SEXP storage_, SEXP mem_, SEXP seed_)
+{
+  SEXP values;
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
+  
+  const int k = INT(k_);
+  const int l = INT(l_);
+  const int passes = INT(passes_);
+  const hsize_t n = (hsize_t) DBL(n_);
+  const int storage = INT(storage_);
+  const double mem = DBL(mem_);
+  const uint64_t seed = (uint64_t) DBL(seed_);
+  
+  if (INT(type) == TYPE_DOUBLE)
+  {
+    PROTECT(values = allocVector(REALSXP, k));
+    TRY_CATCH( reigen_sym(n, k, l, passes, REAL(values), seed, mem, storage, dataset, H5::PredType::IEEE_F64LE) );
+  }
+  else // if (INT(type) == TYPE_FLOAT)
+  {
+    PROTECT(values = allocVector(INTSXP, k));
+    TRY_CATCH( reigen_sym(n, k, l, passes, FLOAT(values), seed, mem, storage, dataset, H5::PredType::IEEE_F32LE) );
+  }
+  
+  stats_end(st);
+  UNPROTECT(1);
+  return values;
+}
@@ -1,60 +1,134 @@
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
+#include <stdexcept>
 
 #include "omp.h"
+#include "panel.hh"
 
 #include "hdfmat.h"
 #include "extptr.h"
 #include "types.h"
 
 
+// elements per block of a panel that all ops are applied to before moving on,
+// so the data stays in cache across the ops
+#define EW_BLOCK 4096
+
+
 template <typename T>
-static inline void scale(const T val, const hsize_t m, const hsize_t n,
-  H5::DataSet *dataset, H5::PredType h5type)
+static inline void ew_op(const int op, const T a, const T b, const hsize_t len,
+  T *x)
 {
-  T *x = (T*) std::malloc(n * sizeof(*x));
-  
-  hsize_t slice[2];
-  slice[0] = 1;
-  slice[1] = n;
+  switch (op)
+  {
+    case EW_SCALE:
+      #pragma omp simd
+      for (hsize_t j=0; j<len; j++)
+        x[j] *= a;
+      break;
+    
+    case EW_ADD:
+      #pragma omp simd
+      for (hsize_t j=0; j<len; j++)
+        x[j] += a;
+      break;
+    
+    case EW_POW:
+      #pragma omp simd
+      for (hsize_t j=0; j<len; j++)
+        x[j] = std::pow(x[j], a);
+      break;
+    
+    case EW_ABS:
+      #pragma omp simd
+      for (hsize_t j=0; j<len; j++)
+        x[j] = std::fabs(x[j]);
+      break;
+    
+    case EW_CLAMP:
+      #pragma omp simd
+      for (hsize_t j=0; j<len; j++)
+        x[j] = std::min(std::max(x[j], a), b);
+      break;
+    
+    case EW_LOG:
+      // a = 1/log(base)
+      #pragma omp simd
+      for (hsize_t j=0; j<len; j++)
+        x[j] = std::log(x[j]) * a;
+      break;
+    
+    default:
+      break;
+  }
+}
+
+
+
+// Apply nops element-wise ops (with arguments args[2*k], args[2*k+1]) in one
+// read/write pass over the stored elements.
+template <typename T>
+static inline void ew(const int nops, const int *ops, const double *args,
+  const hsize_t m, const hsize_t n, const int storage, H5::DataSet *dataset,
+  H5::PredType h5type)
+{
+  // checked up front: nothing may throw inside the parallel region
+  for (int k=0; k<nops; k++)
+  {
+    if (ops[k] < EW_SCALE || ops[k] > EW_LOG)
+      throw std::runtime_error("unknown element-wise op");
+  }
   
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(T), STREAM_MEM/2, storage, dataset);
   
-  hsize_t offset[2];
-  offset[1] = 0;
+  panel_stream<T> s(m, nr, n,
+    [&](hsize_t i, hsize_t rows, T *x) {
+      read_panel_stored(i, rows, n, x, storage, dataset, h5type);
+    },
+    [&](hsize_t i, hsize_t rows, const T *x) {
+      write_panel_stored(i, rows, n, x, storage, dataset, h5type);
+    }
+  );
   
-  for (hsize_t i=0; i<m; i++)
+  for (hsize_t i=0; i<m; i+=nr)
   {
-    offset[0] = i;
-    data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-    dataset->read(x, h5type, mem_space, data_space);
-    
-    #pragma omp for simd
-    for (hsize_t j=0; j<n; j++)
-      x[j] *= val;
+    const hsize_t len = std::min(nr, m-i) * (n - stored_col_start(i, storage));
+    T *x = s.next();
     
-    dataset->write(x, h5type, mem_space, data_space);
+    #pragma omp parallel for if(len > OMP_MIN_LEN)
+    for (hsize_t j=0; j<len; j+=EW_BLOCK)
+    {
+      const hsize_t b = std::min((hsize_t)EW_BLOCK, len-j);
+      for (int k=0; k<nops; k++)
+        ew_op(ops[k], (T)args[2*k], (T)args[2*k + 1], b, x+j);
+    }
   }
   
-  std::free(x);
+  s.finish();
 }
 
-extern "C" SEXP R_hdfmat_scale(SEXP m_, SEXP n_, SEXP ds, SEXP val_, SEXP type)
+extern "C" SEXP R_hdfmat_ew(SEXP m_, SEXP n_, SEXP ds, SEXP ops_, SEXP args_,
+  SEXP type, SEXP storage)
 {
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const hsize_t m = (hsize_t) REAL(m_)[0];
   const hsize_t n = (hsize_t) REAL(n_)[0];
-  const double val = REAL(val_)[0];
+  const int nops = LENGTH(ops_);
+  const int *ops = INTEGER(ops_);
+  const double *args = REAL(args_);
   
   if (INT(type) == TYPE_DOUBLE)
   {
-    TRY_CATCH( scale(val, m, n, dataset, H5::PredType::IEEE_F64LE) );
+    TRY_CATCH( ew<double>(nops, ops, args, m, n, INT(storage), dataset, H5::PredType::IEEE_F64LE) );
   }
   else // if (INT(type) == TYPE_FLOAT)
   {
-    TRY_CATCH( scale((float)val, m, n, dataset, H5::PredType::IEEE_F32LE) );
+    TRY_CATCH( ew<float>(nops, ops, args, m, n, INT(storage), dataset, H5::PredType::IEEE_F32LE) );
   }
   
+  stats_end(st);
   return R_NilValue;
 }
@@ -0,0 +1,34 @@
+#include "stats.hh"
+
+#include "hdfmat.h"
+#include "extptr.h"
+#include "types.h"
+
+
+// the counters of the dataset, in the order of io_stats, optionally zeroing
+// them afterwards
+extern "C" SEXP R_hdfmat_stats(SEXP ds, SEXP reset_)
+{
+  SEXP ret;
+  H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_get(dataset);
+  
+  PROTECT(ret = allocVector(REALSXP, STATS_LEN));
+  REAL(ret)[0] = st->calls;
+  REAL(ret)[1] = st->reads;
+  REAL(ret)[2] = st->writes;
+  REAL(ret)[3] = st->bytes_read;
+  REAL(ret)[4] = st->bytes_written;
+  REAL(ret)[5] = st->maps;
+  REAL(ret)[6] = st->bytes_mapped;
+  REAL(ret)[7] = st->wall;
+  REAL(ret)[8] = st->io;
+  REAL(ret)[9] = st->blocked;
+  REAL(ret)[10] = st->convert;
+  
+  if (LOGICAL(reset_)[0])
+    stats_reset(dataset);
+  
+  UNPROTECT(1);
+  return ret;
+}
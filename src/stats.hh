@@ -0,0 +1,193 @@
+#ifndef HDFMAT_STATS_H
+#define HDFMAT_STATS_H
+#pragma once
+
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include <H5Cpp.h>
+
+
+// Per-dataset counters, returned by stats(). Times are in seconds:
+// - wall: in the native calls made on the dataset
+// - io: in HDF5 reads and writes (including decompression and HDF5's own
+//   type conversion), on whichever thread made them
+// - blocked: part of wall spent waiting for I/O, either in HDF5 calls on the
+//   R thread or in waits on the stream thread
+// - convert: in the package's own transposes and type conversions
+// compute is what is left of wall.
+struct io_stats
+{
+  double calls;
+  double reads;
+  double writes;
+  double bytes_read;
+  double bytes_written;
+  double maps;
+  double bytes_mapped;
+  double wall;
+  double io;
+  double blocked;
+  double convert;
+  double t0;
+};
+
+#define STATS_LEN 11
+
+
+
+static inline double stats_clock()
+{
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+// The stream thread updates the counters of a dataset while the R thread may
+// update others (or other fields), so the table is guarded; no two threads
+// ever do I/O at once, so the I/O fields themselves are not. The functions
+// holding the table and the thread-local state are extern inline so that
+// every translation unit shares them.
+inline std::mutex& stats_mutex()
+{
+  static std::mutex mtx;
+  return mtx;
+}
+
+inline std::unordered_map<const H5::DataSet*, io_stats>& stats_table()
+{
+  static std::unordered_map<const H5::DataSet*, io_stats> table;
+  return table;
+}
+
+inline io_stats* stats_get(const H5::DataSet *dataset)
+{
+  std::lock_guard<std::mutex> lock(stats_mutex());
+  auto &table = stats_table();
+  
+  auto it = table.find(dataset);
+  if (it == table.end())
+  {
+    io_stats st;
+    std::memset(&st, 0, sizeof(st));
+    it = table.emplace(dataset, st).first;
+  }
+  
+  return &(it->second);
+}
+
+// Drop the counters of a dataset: they start again from zero on its next use.
+// Also called when the dataset is closed or freed, so the table does not grow
+// and a dataset allocated later at the same address starts from zero.
+static inline void stats_reset(const H5::DataSet *dataset)
+{
+  std::lock_guard<std::mutex> lock(stats_mutex());
+  stats_table().erase(dataset);
+}
+
+
+
+// dataset of the native call running on the R thread, for the counters that
+// are not tied to an HDF5 call; and whether this thread is a stream thread.
+// Its counters are looked up again on every use rather than kept: a call that
+// ends in an R error never reaches stats_end(), and by the next call they may
+// have been dropped by stats_reset().
+inline const H5::DataSet*& stats_current()
+{
+  static thread_local const H5::DataSet *ds = NULL;
+  return ds;
+}
+
+inline bool& stats_in_stream()
+{
+  static thread_local bool in_stream = false;
+  return in_stream;
+}
+
+
+
+// Bracket a native call. Calls that end in an R error are not timed.
+static inline io_stats* stats_begin(const H5::DataSet *dataset)
+{
+  io_stats *st = stats_get(dataset);
+  st->calls++;
+  st->t0 = stats_clock();
+  stats_current() = dataset;
+  return st;
+}
+
+static inline void stats_end(io_stats *st)
+{
+  st->wall += stats_clock() - st->t0;
+  stats_current() = NULL;
+}
+
+
+
+static inline void stats_io(const H5::DataSet *dataset, const bool write,
+  const double bytes, const double t)
+{
+  io_stats *st = stats_get(dataset);
+  if (write)
+  {
+    st->writes++;
+    st->bytes_written += bytes;
+  }
+  else
+  {
+    st->reads++;
+    st->bytes_read += bytes;
+  }
+  
+  st->io += t;
+  if (!stats_in_stream())
+    st->blocked += t;
+}
+
+static inline void stats_map(const H5::DataSet *dataset)
+{
+  stats_get(dataset)->maps++;
+}
+
+// bytes used in place from a memory map; not timed, since page faults are
+// spread over the kernel's own loads
+static inline void stats_mapped(const H5::DataSet *dataset, const double bytes)
+{
+  stats_get(dataset)->bytes_mapped += bytes;
+}
+
+// counters of the current call's dataset, if it has any; the caller holds the
+// table's mutex
+static inline io_stats* stats_find_current()
+{
+  const H5::DataSet *dataset = stats_current();
+  if (dataset == NULL)
+    return NULL;
+  
+  auto &table = stats_table();
+  auto it = table.find(dataset);
+  return (it == table.end()) ? NULL : &(it->second);
+}
+
+static inline void stats_wait(const double t)
+{
+  std::lock_guard<std::mutex> lock(stats_mutex());
+  io_stats *st = stats_find_current();
+  if (st != NULL)
+    st->blocked += t;
+}
+
+static inline void stats_convert(const double t)
+{
+  std::lock_guard<std::mutex> lock(stats_mutex());
+  io_stats *st = stats_find_current();
+  if (st != NULL)
+    st->convert += t;
+}
+
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef HDFMAT_STREAM_H
+#define HDFMAT_STREAM_H
+#pragma once
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <new>
+
+#include <H5Cpp.h>
+
+#include "mmap.hh"
+#include "stats.hh"
+
+
+// Double-buffered pass over the row panels [start, start+nr), ... of an m-row
+// dataset. The HDF5 I/O for the neighboring panels (the write-back of the
+// previous one and the read of the next one) runs on a background thread
+// while the caller computes on the current panel, so a pass costs about
+// max(I/O, compute) instead of their sum.
+//
+// Panels are row-major buffers of up to nr x len elements; read or write may
+// be empty for a write-only or read-only pass. Each next() hands out the next
+// panel, and finish() writes back the last one. Only the background thread
+// touches the file between construction and finish(), so HDF5 is never called
+// from two threads at once. I/O errors are rethrown by next() and finish().
+//
+// A read-only pass over a memory-mapped m x len matrix (see mmap.hh) can
+// instead be given the map; if it is mapped, next() hands out the panels in
+// place, with no buffers, copies, or background thread. Such panels must not
+// be written to.
+template <typename T>
+class panel_stream
+{
+  public:
+    typedef std::function<void(hsize_t, hsize_t, T*)> read_fun;
+    typedef std::function<void(hsize_t, hsize_t, const T*)> write_fun;
+    
+    panel_stream(const hsize_t m, const hsize_t nr, const hsize_t len,
+      read_fun read, write_fun write=write_fun(), const hsize_t start=0);
+    panel_stream(const hsize_t m, const hsize_t nr, const hsize_t len,
+      read_fun read, const dataset_map &mapped);
+    ~panel_stream();
+    
+    T* next();
+    void finish();
+  
+  private:
+    hsize_t m;
+    hsize_t nr;
+    hsize_t row;
+    hsize_t p;
+    hsize_t len;
+    const T *map;
+    const dataset_map *mapped;
+    read_fun read;
+    write_fun write;
+    T *buf[2];
+    std::future<void> job;
+    
+    hsize_t rows(const hsize_t i) const {return std::min(nr, m-i);};
+    static T* alloc(const hsize_t len);
+    void io(const hsize_t w_row, const T *w_buf, const hsize_t r_row, T *r_buf);
+    void wait();
+};
+
+
+
+template <typename T>
+panel_stream<T>::panel_stream(const hsize_t m, const hsize_t nr,
+  const hsize_t len, read_fun read, write_fun write, const hsize_t start)
+: m(m), nr(nr), row(start), p(0), len(len), map(NULL), mapped(NULL), read(read), write(write)
+{
+  buf[0] = alloc(nr*len);
+  buf[1] = (m - start > nr) ? alloc(nr*len) : NULL;
+  
+  if (read && start < m)
+    job = std::async(std::launch::async, &panel_stream<T>::io, this, (hsize_t)0, (const T*)NULL, start, buf[0]);
+}
+
+
+
+template <typename T>
+panel_stream<T>::panel_stream(const hsize_t m, const hsize_t nr,
+  const hsize_t len, read_fun read, const dataset_map &mapped)
+: m(m), nr(nr), row(0), p(0), len(len), map(mapped.rows<T>()), mapped(&mapped), read(read)
+{
+  buf[0] = buf[1] = NULL;
+  
+  if (map == NULL)
+  {
+    buf[0] = alloc(nr*len);
+    buf[1] = (m > nr) ? alloc(nr*len) : NULL;
+    
+    if (read && m > 0)
+      job = std::async(std::launch::async, &panel_stream<T>::io, this, (hsize_t)0, (const T*)NULL, (hsize_t)0, buf[0]);
+  }
+}
+
+
+
+template <typename T>
+panel_stream<T>::~panel_stream()
+{
+  // only reached with a pending job if the caller is unwinding
+  if (job.valid())
+  {
+    try { job.get(); } catch (...) {}
+  }
+  
+  std::free(buf[0]);
+  std::free(buf[1]);
+}
+
+
+
+template <typename T>
+T* panel_stream<T>::next()
+{
+  if (map != NULL)
+  {
+    T *cur = const_cast<T*>(map + row*len);
+    mapped->used((double) (rows(row)*len*sizeof(T)));
+    row += nr;
+    return cur;
+  }
+  
+  wait();
+  
+  T *cur = buf[p % 2];
+  T *other = buf[(p+1) % 2];
+  const hsize_t next_row = row + nr;
+  
+  // the other buffer holds the previous panel; write it back before reusing
+  // it for the next one
+  const T *w_buf = (write && p > 0) ? other : NULL;
+  T *r_buf = (read && next_row < m) ? other : NULL;
+  if (w_buf != NULL || r_buf != NULL)
+    job = std::async(std::launch::async, &panel_stream<T>::io, this, row - nr, w_buf, next_row, r_buf);
+  
+  row = next_row;
+  p++;
+  
+  return cur;
+}
+
+
+
+template <typename T>
+void panel_stream<T>::finish()
+{
+  wait();
+  
+  if (write && p > 0)
+  {
+    const hsize_t last = row - nr;
+    write(last, rows(last), buf[(p-1) % 2]);
+  }
+  
+  p = 0;
+}
+
+
+
+template <typename T>
+void panel_stream<T>::io(const hsize_t w_row, const T *w_buf,
+  const hsize_t r_row, T *r_buf)
+{
+  stats_in_stream() = true;
+  
+  if (w_buf != NULL)
+    write(w_row, rows(w_row), w_buf);
+  
+  if (r_buf != NULL)
+    read(r_row, rows(r_row), r_buf);
+}
+
+
+
+template <typename T>
+T* panel_stream<T>::alloc(const hsize_t len)
+{
+  T *x = (T*) std::malloc(len * sizeof(*x));
+  if (x == NULL)
+    throw std::bad_alloc();
+  
+  return x;
+}
+
+
+
+template <typename T>
+void panel_stream<T>::wait()
+{
+  if (job.valid())
+  {
+    const double t = stats_clock();
+    job.wait();
+    stats_wait(stats_clock() - t);
+    job.get();
+  }
+}
+
+
+#endif
@@ -1,5 +1,8 @@
+#include <algorithm>
+
 #include "lanczos.hh"
 #include "omp.h"
+#include "panel.hh"
 
 #include <fml/src/fml/cpu/cpumat.hh>
 #include <fml/src/fml/cpu/cpuvec.hh>
@@ -10,41 +13,39 @@
 #include "types.h"
 
 
-template <typename T>
+// The file holds S; the recurrence runs in T, with each panel widened to T
+// once and used for both products.
+template <typename T, typename S=T>
 static inline void lanczos(const hsize_t m, const hsize_t n, const int k,
-  T *alpha, T *beta, T *q, H5::DataSet *dataset, H5::PredType h5type)
+  T *alpha, T *beta, T *q, const double mem, H5::DataSet *dataset,
+  H5::PredType h5type)
 {
-  T *A_j = (T*) std::malloc(m * sizeof(*A_j));
+  const hsize_t nr = panel_rows_stored(m, n, sizeof(S), widen_mem<S, T>(mem), STORAGE_FULL, dataset);
+  const dataset_map map(dataset, h5type);
+  T *buf = widen_alloc<S, T>(nr*n);
   T *v = (T*) std::malloc((m+n) * sizeof(*v));
   
-  hsize_t slice[2];
-  slice[0] = 1;
-  slice[1] = n;
-  
-  H5::DataSpace mem_space(2, slice, NULL);
-  H5::DataSpace data_space = dataset->getSpace();
-  
-  hsize_t offset[2];
-  offset[1] = 0;
-  
   for (int i=0; i<k; i++)
   {
     std::memset(v+m, 0, n*sizeof(*v));
     
-    // v = A*q[, i] iterate over *row j* of A - A_j is 1xn
-    for (hsize_t j=0; j<m; j++)
+    // v = [A*q[m+1:m+n, i]; t(A)*q[1:m, i]] iterate over *row panel j* of A
+    // - A_p is rows x n
+    panel_stream<S> s(m, nr, n, [&](hsize_t j, hsize_t rows, S *x) {
+      read_panel(j, rows, (hsize_t)0, n, x, dataset, h5type);
+    }, map);
+    
+    for (hsize_t j=0; j<m; j+=nr)
     {
-      offset[0] = j;
-      data_space.selectHyperslab(H5S_SELECT_SET, slice, offset);
-      dataset->read(A_j, h5type, mem_space, data_space);
+      const hsize_t rows = std::min(nr, m-j);
+      const T *A_p = widen(rows*n, s.next(), buf);
       
-      #pragma omp for simd
-      for (hsize_t jj=0; jj<n; jj++)
-        v[m+jj] += A_j[jj] * q[j + (m+n)*i];
-      
-      v[j] = dot(n, A_j, q + m+(m+n)*i);
+      gemv('N', n, rows, A_p, q + j+(m+n)*i, (T)1, v+m);
+      gemv('T', n, rows, A_p, q + m+(m+n)*i, (T)0, v+j);
     }
     
+    s.finish();
+    
     alpha[i] = dot(m+n, q + (m+n)*i, v);
     
     if (i == 0)
@@ -76,21 +77,22 @@ static inline void lanczos(const hsize_t m, const hsize_t n, const int k,
     }
   }
   
-  std::free(A_j);
   std::free(v);
+  std::free(buf);
 }
 
 
 
-template <typename T>
+template <typename T, typename S=T>
 static inline void svd(const hsize_t m, const hsize_t n, const int k,
-  T *values, H5::DataSet *dataset, H5::PredType h5type)
+  T *values, const uint64_t seed, const double mem, H5::DataSet *dataset,
+  H5::PredType h5type)
 {
   T *alpha, *beta, *q;
   alloc(m+n, k, &alpha, &beta, &q);
-  initialize(m+n, k, q);
+  initialize(m+n, k, q, seed);
   
-  lanczos(m, n, k, alpha, beta, q, dataset, h5type);
+  lanczos<T, S>(m, n, k, alpha, beta, q, mem, dataset, h5type);
   std::free(q);
   
   T *td = (T *) std::malloc(k*k * sizeof(*td));
@@ -113,26 +115,39 @@ static inline void svd(const hsize_t m, const hsize_t n, const int k,
 
 
 
-extern "C" SEXP R_hdfmat_svd(SEXP k_, SEXP m_, SEXP n_, SEXP ds, SEXP type)
+// With mixed set, float data is read as float and the Lanczos vectors and
+// values are double.
+extern "C" SEXP R_hdfmat_svd(SEXP k_, SEXP m_, SEXP n_, SEXP ds, SEXP type,
+  SEXP mem_, SEXP seed_, SEXP mixed_)
 {
   SEXP values;
   H5::DataSet *dataset = (H5::DataSet*) getRptr(ds);
+  io_stats *st = stats_begin(dataset);
   
   const int k = INT(k_);
   const hsize_t m = (hsize_t) DBL(m_);
   const hsize_t n = (hsize_t) DBL(n_);
+  const double mem = DBL(mem_);
+  const uint64_t seed = (uint64_t) DBL(seed_);
+  const bool mixed = (bool) LOGICAL(mixed_)[0];
   
   if (INT(type) == TYPE_DOUBLE)
   {
     PROTECT(values = allocVector(REALSXP, k));
-    TRY_CATCH( svd(m, n, k, REAL(values), dataset, H5::PredType::IEEE_F64LE) );
+    TRY_CATCH( svd(m, n, k, REAL(values), seed, mem, dataset, H5::PredType::IEEE_F64LE) );
+  }
+  else if (mixed)
+  {
+    PROTECT(values = allocVector(REALSXP, k));
+    TRY_CATCH( (svd<double, float>(m, n, k, REAL(values), seed, mem, dataset, H5::PredType::IEEE_F32LE)) );
   }
   else // if (INT(type) == TYPE_FLOAT)
   {
     PROTECT(values = allocVector(INTSXP, k));
-    TRY_CATCH( svd(m, n, k, FLOAT(values), dataset, H5::PredType::IEEE_F32LE) );
+    TRY_CATCH( svd(m, n, k, FLOAT(values), seed, mem, dataset, H5::PredType::IEEE_F32LE) );
   }
   
+  stats_end(st);
   UNPROTECT(1);
   return values;
 }
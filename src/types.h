@@ -9,7 +9,67 @@
 
 #define TYPE_DOUBLE 1
 #define TYPE_FLOAT 2
+#define TYPE_FLOAT16 3
+#define TYPE_BFLOAT16 4
+#define TYPE_INT8 5
 #define TYPE_ERR "unsupported fundamental type"
 
+// compact types are computed on in float; int8 keeps a float scale per row
+// in the dataset named with QSCALE_SUFFIX appended
+#define QSCALE_SUFFIX "_scale"
+
+#define STORAGE_FULL 1
+#define STORAGE_SYM 2
+
+// symmetric storage only keeps the upper SYM_TILE x SYM_TILE chunks
+#define STORAGE_ATTR "hdfmat_storage"
+#define STORAGE_SYM_STR "symmetric"
+#define SYM_TILE 256
+
+#define CHUNK_ROWS 1
+#define CHUNK_COLS 2
+#define CHUNK_TILES 3
+#define CHUNK_CONTIGUOUS 4
+
+#define FILTER_SHUFFLE 1
+#define FILTER_DEFLATE 2
+#define FILTER_NBIT 3
+#define FILTER_SCALEOFFSET 4
+
+// chunks hold about CHUNK_BYTES; the raw data chunk cache of a dataset holds
+// a row of chunks, between CHUNK_CACHE_MIN and CHUNK_CACHE_MAX bytes
+#define CHUNK_ATTR "hdfmat_chunking"
+#define CHUNK_BYTES (1 << 20)
+#define CHUNK_CACHE_MIN (1 << 20)
+#define CHUNK_CACHE_MAX (64 << 20)
+
+// element-wise ops of compute()
+#define EW_SCALE 1
+#define EW_ADD 2
+#define EW_POW 3
+#define EW_ABS 4
+#define EW_CLAMP 5
+#define EW_LOG 6
+
+// reductions of reduce(), as bit flags
+#define REDUCE_ROWS 1
+#define REDUCE_COLS 2
+#define REDUCE_TRACE 4
+
+// target size of a cached block of rows of an unchunked dataset
+#define CACHE_BLOCK_BYTES (256 << 10)
+
+// memory budget (MiB) of the stream buffers for kernels without a mem argument
+#define STREAM_MEM 64
+
+// memory budget (MiB) of the buffers of column-major reads and writes, on top
+// of the in-memory matrix, and the tile size of their transposes
+#define TRANSPOSE_MEM 8
+#define TRANSPOSE_BLOCK 32
+
+// memory budget (MiB) of the compressed chunks held at once by direct chunk
+// writes
+#define CHUNK_WRITE_MEM 16
+
 
 #endif
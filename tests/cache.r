@@ -0,0 +1,64 @@
+library(hdfmat)
+
+f = tempfile()
+type = "double"
+
+nr = 100
+nc = 20
+x = matrix(sin(1:(nr*nc)), nr, nc)
+
+h = hdfmat::hdfmat(f, "x", nr, nc, type, compression=4L)
+h$fill(x)
+stopifnot(is.null(h$cache_info()))
+
+h$cache(mem=1)
+stopifnot(all.equal(h$read(row_start=11, row_stop=20), x[11:20, ]))
+stopifnot(all.equal(h$read(row_start=12, row_stop=15, col_start=3, col_stop=9), x[12:15, 3:9]))
+
+info = h$cache_info()
+stopifnot(info$misses >= 1)
+stopifnot(info$hits >= 1)
+stopifnot(info$bytes > 0)
+
+# writes drop stale rows
+h$scale(2)
+stopifnot(all.equal(h$read(row_start=11, row_stop=20), 2*x[11:20, ]))
+
+h$fill(x[1:10, ], row_offset=10)
+stopifnot(all.equal(h$read(row_start=11, row_stop=20), x[1:10, ]))
+
+# and so do writes of another hdfmat's product into this one
+g = tempfile()
+y = matrix(cos(1:(nc*nc)), nc, nc)
+hx = hdfmat::hdfmat(g, "x", nr, nc, type)
+hx$fill(x)
+h$fill(x)
+stopifnot(all.equal(h$read(), x))
+hx$matmult(y, out=h)
+stopifnot(all.equal(h$read(), x %*% y))
+hx$close()
+unlink(g)
+
+h$cache(mem=0)
+stopifnot(is.null(h$cache_info()))
+
+h$close()
+unlink(f)
+
+# uncompressed contiguous matrices, otherwise read through a memory map, use
+# the cache too
+h = hdfmat::hdfmat(f, "x", nr, nc, type)
+h$fill(x)
+h$cache(mem=1)
+stopifnot(all.equal(h$read(row_start=11, row_stop=20), x[11:20, ]))
+stopifnot(all.equal(h$read(row_start=12, row_stop=15, col_start=3, col_stop=9), x[12:15, 3:9]))
+
+info = h$cache_info()
+stopifnot(info$misses >= 1)
+stopifnot(info$hits >= 1)
+
+h$scale(2)
+stopifnot(all.equal(h$read(row_start=11, row_stop=20), 2*x[11:20, ]))
+
+h$close()
+unlink(f)
@@ -0,0 +1,29 @@
+library(hdfmat)
+
+f = tempfile()
+type = "double"
+
+nr = 50
+nc = 40
+x = matrix(1:(nr*nc), nr, nc)
+storage.mode(x) = type
+
+for (chunking in c("rows", "cols", "tiles"))
+{
+  h = hdfmat::hdfmat(f, chunking, nr, nc, type, compression=4L, chunking=chunking)
+  h$fill(x)
+  
+  test = h$read(col_start=11, col_stop=20)
+  truth = x[, 11:20]
+  stopifnot(all.equal(test, truth))
+  
+  h$close()
+  
+  # policy is recorded in the file
+  k = hdfmat::hdfmat_open(f, chunking)
+  stopifnot(any(grepl(chunking, capture.output(print(k)))))
+  stopifnot(all.equal(k$read(), x))
+  k$close()
+}
+
+unlink(f)
@@ -0,0 +1,113 @@
+library(hdfmat)
+
+# compact types round to their precision, and int8 to a step of max|row|/127
+m = 40
+n = 25
+x = matrix(sin(1:(m*n)), m, n) * (1:m)
+f = tempfile()
+
+tol = c(float16=2^-11, bfloat16=2^-8)
+for (type in names(tol))
+{
+  h = hdfmat::hdfmat(f, "x", m, n, type)
+  h$fill(x)
+  test = h$read()
+  stopifnot(float::is.float(test))
+  stopifnot(all(abs(float::dbl(test) - x) <= tol[[type]] * abs(x)))
+  
+  # kernels work on the decoded values
+  y = float::dbl(test)
+  stopifnot(all.equal(float::dbl(h$matmult(diag(n))), y, tolerance=1e-6))
+  stopifnot(all.equal(h$svd(k=3, seed=1, mixed=TRUE), svd(y)$d[1:3]))
+  h$close()
+  unlink(f)
+}
+
+h = hdfmat::hdfmat(f, "x", m, n, "int8")
+h$fill(x)
+step = apply(abs(x), 1, max) / 127
+test = float::dbl(h$read())
+stopifnot(all(abs(test - x) <= step/2 + 1e-6))
+
+# rows written later are quantized with their own scales
+h$fill(matrix(0, 2, n), row_offset=10)
+test = float::dbl(h$read())
+stopifnot(all(test[11:12, ] == 0))
+stopifnot(all(abs(test[-(11:12), ] - x[-(11:12), ]) <= step[-(11:12)]/2 + 1e-6))
+h$close()
+
+# the type survives reopening
+h = hdfmat::hdfmat_open(f, "x")
+stopifnot(all.equal(float::dbl(h$read()), test))
+h$close()
+unlink(f)
+
+# int8 is written whole rows at a time, so band fills and blocked products
+# quantize each row once and stay within half a step
+h = hdfmat::hdfmat(f, "x", m, n, "int8", chunking="tiles")
+h$fill(x)
+a = float::dbl(h$read())
+h$fill_diag(0)
+test = float::dbl(h$read())
+diag(a) = 0
+stopifnot(all(abs(test - a) <= apply(abs(a), 1, max)/127/2 + 1e-6))
+
+f_y = tempfile()
+f_c = tempfile()
+g = hdfmat::hdfmat(f_y, "y", n, 600, "int8")
+g$fill(matrix(cos(1:(n*600)), n, 600))
+b = float::dbl(g$read())
+for (mem in c(64, 0.01))
+{
+  p = hdfmat::matmult_ooc(h, g, f_c, mem=mem)
+  truth = test %*% b
+  test_p = float::dbl(p$read())
+  stopifnot(all(abs(test_p - truth) <= apply(abs(truth), 1, max) * (1/127/2 + 1e-5)))
+  p$close()
+  unlink(f_c)
+}
+
+g$close()
+h$close()
+unlink(c(f, f_y))
+
+stopifnot(inherits(try(hdfmat::hdfmat(f, "x", n, n, "int8", storage="symmetric"), silent=TRUE), "try-error"))
+unlink(f)
+
+# no row scale represents NaN or infinity, so int8 rejects them and keeps
+# what it holds
+h = hdfmat::hdfmat(f, "x", m, n, "int8")
+h$fill_val(1)
+for (v in c(NaN, Inf, -Inf))
+{
+  y = x
+  y[3, 5] = v
+  stopifnot(inherits(try(h$fill(y), silent=TRUE), "try-error"))
+  stopifnot(inherits(try(h$fill_val(v), silent=TRUE), "try-error"))
+}
+stopifnot(all(abs(float::dbl(h$read()) - 1) <= 1e-6))
+h$close()
+unlink(f)
+
+
+
+# symmetric storage over several tiles
+ns = 600
+s = crossprod(matrix(sin(1:(m*ns)), m, ns))
+for (type in names(tol))
+{
+  for (compression in c(0L, 4L))
+  {
+    h = hdfmat::hdfmat(f, "x", ns, ns, type, compression=compression, storage="symmetric")
+    h$fill(s)
+    test = float::dbl(h$read())
+    stopifnot(isSymmetric(test))
+    stopifnot(all(abs(test - s) <= tol[[type]] * abs(s)))
+    h$close()
+    
+    h = hdfmat::hdfmat_open(f, "x")
+    stopifnot(all.equal(float::dbl(h$read()), test))
+    h$close()
+    unlink(f)
+  }
+}
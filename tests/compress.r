@@ -0,0 +1,84 @@
+library(hdfmat)
+
+# whole deflated chunks are compressed on all cores and written directly
+nr = 300
+nc = 200
+x = matrix(sin(1:(nr*nc)), nr, nc)
+
+for (type in c("double", "float"))
+{
+  for (chunking in c("rows", "cols", "tiles"))
+  {
+    f = tempfile()
+    h = hdfmat::hdfmat(f, "x", nr, nc, type, compression=4L, filters="shuffle", chunking=chunking)
+    h$fill(x)
+    h$close()
+    
+    h = hdfmat::hdfmat_open(f, "x")
+    y = h$read()
+    if (type == "float")
+      y = float::dbl(y)
+    stopifnot(max(abs(y - x)) < 1e-6)
+    
+    # partial chunks go through HDF5
+    h$fill(x[1:7, ] + 1, row_offset=3)
+    y = h$read()
+    if (type == "float")
+      y = float::dbl(y)
+    stopifnot(max(abs(y[4:10, ] - x[1:7, ] - 1)) < 1e-6)
+    
+    h$close()
+    unlink(f)
+  }
+}
+
+f = tempfile()
+f_cp = tempfile()
+h = hdfmat::hdfmat(f, "x", nr, nc, "double")
+h$fill(x)
+
+for (storage in c("full", "symmetric"))
+{
+  cp = crossprod_ooc(h, f_cp, compression=1L, storage=storage, mem=0.1)
+  stopifnot(all.equal(cp$read(), crossprod(x)))
+  cp$close()
+}
+
+h$close()
+unlink(c(f, f_cp))
+
+
+
+# symmetric storage over several tiles, whose tile rows are written as whole
+# chunks too
+n = 600
+z = matrix(sin(1:(nr*n)), nr, n)
+s = crossprod(z)
+
+for (filters in list(NULL, "shuffle"))
+{
+  f = tempfile()
+  h = hdfmat::hdfmat(f, "x", n, n, "double", compression=4L, filters=filters, storage="symmetric")
+  h$fill(s)
+  stopifnot(all.equal(h$read(), s))
+  h$close()
+  
+  h = hdfmat::hdfmat_open(f, "x")
+  stopifnot(all.equal(h$read(), s))
+  h$close()
+  unlink(f)
+}
+
+f = tempfile()
+f_cp = tempfile()
+h = hdfmat::hdfmat(f, "x", nr, n, "double")
+h$fill(z)
+for (mem in c(64, 1))
+{
+  cp = crossprod_ooc(h, f_cp, compression=4L, storage="symmetric", mem=mem)
+  stopifnot(all.equal(cp$read(), s))
+  cp$close()
+}
+
+h$close()
+unlink(c(f, f_cp))
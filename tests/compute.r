@@ -0,0 +1,61 @@
+library(hdfmat)
+
+f = tempfile()
+n = "mydata"
+type = "double"
+
+nr = 30
+nc = 20
+x = matrix(1:(nr*nc), nr, nc) - 300
+storage.mode(x) = type
+
+h = hdfmat::hdfmat(f, n, nr, nc, type)
+h$fill(x)
+
+# the ops are only recorded, then applied in one pass
+h$scale(0.5, lazy=TRUE)$add(1)$abs()$pow(2)
+h$clamp(1, 1000)$log(base=10)$compute()
+test = h$read()
+truth = log10(pmin(pmax(abs(0.5*x + 1)^2, 1), 1000))
+stopifnot(all.equal(test, truth))
+
+# readers apply the pending ops first
+h$fill(x)
+h$scale(2, lazy=TRUE)$add(1)
+stopifnot(all.equal(h$read(1, 3), 2*x[1:3, ] + 1))
+stopifnot(all.equal(h$read(), 2*x + 1))
+stopifnot(all.equal(h$reduce("colSums"), colSums(2*x + 1)))
+
+# a partial fill applies them to the old data only
+h$fill(x)
+h$scale(2, lazy=TRUE)
+h$fill(x[1:10, ])
+stopifnot(all.equal(h$read(), rbind(x[1:10, ], 2*x[11:nr, ])))
+
+# a full fill replaces the data, so the ops are dropped
+h$add(5)
+h$fill(x)
+stopifnot(all.equal(h$read(), x))
+h$compute()
+stopifnot(all.equal(h$read(), x))
+
+# an eager scale() also applies the pending ops
+h$fill(x)
+h$add(-1)$scale(2)
+stopifnot(all.equal(h$read(), 2*(x - 1)))
+
+# a fill that fails its checks keeps them
+h$fill(x)
+h$add(1)
+stopifnot(inherits(try(h$fill_runif(1, 0), silent=TRUE), "try-error"))
+stopifnot(inherits(try(h$fill_crossprod(x), silent=TRUE), "try-error"))
+stopifnot(all.equal(h$read(), x + 1))
+
+# and close() applies them
+h$add(1)
+h$close()
+h = hdfmat_open(f, n)
+stopifnot(all.equal(h$read(), x + 2))
+
+h$close()
+unlink(f)
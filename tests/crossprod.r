@@ -16,5 +16,10 @@ truth = crossprod(x)
 
 stopifnot(all.equal(test, truth))
 
+# one row of the result per band
+h$fill_crossprod(x, mem=1e-6)
+test = h$read()
+stopifnot(all.equal(test, truth))
+
 h$close()
 unlink(f)
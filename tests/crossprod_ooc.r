@@ -0,0 +1,35 @@
+library(hdfmat)
+
+f = tempfile()
+f_cp = tempfile()
+f_tcp = tempfile()
+type = "double"
+
+nr = 25
+nc = 4
+x = matrix(1:(nr*nc), nr, nc)
+storage.mode(x) = type
+
+h = hdfmat(f, "x", nr, nc, type)
+h$fill(x)
+
+# input streamed a few rows at a time
+cp = crossprod_ooc(h, f_cp, name="cp", mem=1e-3)
+test = cp$read()
+truth = crossprod(x)
+stopifnot(all.equal(test, truth))
+
+tcp = tcrossprod_ooc(h, f_tcp, name="tcp", storage="symmetric", mem=1e-3)
+test = tcp$read()
+truth = tcrossprod(x)
+stopifnot(all.equal(test, truth))
+
+# the result cannot be its own input
+stopifnot(inherits(try(cp$fill_crossprod(cp), silent=TRUE), "try-error"))
+stopifnot(inherits(try(tcp$fill_tcrossprod(tcp), silent=TRUE), "try-error"))
+stopifnot(all.equal(tcp$read(), truth))
+
+h$close()
+cp$close()
+tcp$close()
+unlink(c(f, f_cp, f_tcp))
@@ -0,0 +1,40 @@
+library(hdfmat)
+
+# deflated datasets are read chunk by chunk and inflated on all cores
+nr = 200
+nc = 150
+x = matrix(sin(1:(nr*nc)), nr, nc)
+
+g = tempfile()
+hc = hdfmat::hdfmat(g, "x", nr, nc, "double")
+hc$fill(x)
+d = hc$svd(k=3, mem=0.05, seed=1)
+hc$close()
+unlink(g)
+
+for (filters in list(NULL, "shuffle"))
+{
+  for (chunking in c("rows", "cols", "tiles"))
+  {
+    f = tempfile()
+    h = hdfmat::hdfmat(f, "x", nr, nc, "double", compression=4L, filters=filters, chunking=chunking)
+    h$fill(x)
+    h$close()
+    
+    h = hdfmat::hdfmat_open(f, "x")
+    stopifnot(all.equal(h$read(), x))
+    stopifnot(all.equal(h$read(11, 123, 7, 99), x[11:123, 7:99]))
+    
+    stopifnot(all.equal(h$svd(k=3, mem=0.05, seed=1), d))
+    
+    h$close()
+    unlink(f)
+  }
+}
+
+f = tempfile()
+h = hdfmat::hdfmat(f, "x", nr, nc, "float", compression=1L, filters="shuffle", chunking="tiles")
+h$fill(x)
+stopifnot(max(abs(float::dbl(h$read()) - x)) < 1e-6)
+h$close()
+unlink(f)
@@ -18,5 +18,15 @@ truth = c(9450.2858568857428, 4.714143114255676, 5.0978833483225391e-13)
 tol = 1e-6
 stopifnot(all.equal(test, truth, tol))
 
+# force one row per panel
+set.seed(1234)
+test = h$eigen(k=3, mem=1e-6)
+stopifnot(all.equal(test, truth, tol))
+
+# block Lanczos
+set.seed(1234)
+test = h$eigen(k=3, block=2)
+stopifnot(all.equal(test, truth, tol))
+
 h$close()
 unlink(f)
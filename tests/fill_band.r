@@ -0,0 +1,69 @@
+library(hdfmat)
+
+f = tempfile()
+n = "mydata"
+type = "double"
+
+# 362 x 362 tiles (about 1 MiB of doubles), so the matrix spans 3 x 3 chunks
+# with ragged last ones, and the bands run through chunk corners and edges
+nr = 800
+nc = 900
+x = matrix(as.double(1:(nr*nc)), nr, nc)
+d = col(x) - row(x)
+
+for (compression in c(0L, 4L))
+{
+  h = hdfmat::hdfmat(f, n, nr, nc, type, compression=compression, chunking="tiles")
+  
+  h$fill(x)
+  h$fill_band(-1, lower=2, upper=3)
+  truth = x
+  truth[d >= -2 & d <= 3] = -1
+  stopifnot(all.equal(h$read(), truth))
+  
+  # a band wider than a chunk
+  h$fill(x)
+  h$fill_band(-2, lower=400, upper=0)
+  truth = x
+  truth[d >= -400 & d <= 0] = -2
+  stopifnot(all.equal(h$read(), truth))
+  
+  h$fill(x)
+  h$fill_diag(c(7, 8, 9))
+  truth = x
+  diag(truth) = rep(c(7, 8, 9), length.out=min(nr, nc))
+  stopifnot(all.equal(h$read(), truth))
+  
+  h$fill(x)
+  h$fill_tri(0, upper=FALSE, diag=FALSE)
+  truth = x
+  truth[lower.tri(truth)] = 0
+  stopifnot(all.equal(h$read(), truth))
+  
+  h$fill(x)
+  h$fill_tri(5)
+  truth = x
+  truth[upper.tri(truth, diag=TRUE)] = 5
+  stopifnot(all.equal(h$read(), truth))
+  
+  h$fill_identity()
+  stopifnot(all.equal(h$read(), diag(1, nr, nc)))
+  
+  h$close()
+  unlink(f)
+}
+
+# symmetric storage, 600 x 600 in 256 x 256 tiles
+ns = 600
+s = crossprod(matrix(sin(1:(10*ns)), 10, ns))
+h = hdfmat::hdfmat(f, n, ns, ns, type, storage="symmetric")
+h$fill(s)
+h$fill_band(0, lower=300, upper=300)
+truth = s
+truth[abs(col(s) - row(s)) <= 300] = 0
+stopifnot(all.equal(h$read(), truth))
+
+h$fill_identity()
+stopifnot(all.equal(h$read(), diag(ns)))
+h$close()
+unlink(f)
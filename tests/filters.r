@@ -0,0 +1,34 @@
+library(hdfmat)
+
+f = tempfile()
+type = "double"
+
+nr = 30
+nc = 20
+x = matrix(sin(1:(nr*nc)), nr, nc)
+
+# lossless
+h = hdfmat::hdfmat(f, "x", nr, nc, type, compression=1L, filters="shuffle")
+h$fill(x)
+h$close()
+
+h = hdfmat::hdfmat_open(f, "x")
+stopifnot(any(grepl("shuffle, deflate(1)", capture.output(print(h)), fixed=TRUE)))
+stopifnot(all.equal(h$read(), x))
+h$close()
+
+# lossy
+h = hdfmat::hdfmat(f, "x", nr, nc, type, filters=c("scaleoffset", "deflate"), digits=3)
+h$fill(x)
+h$close()
+
+h = hdfmat::hdfmat_open(f, "x")
+stopifnot(max(abs(h$read() - x)) < 1e-3)
+h$close()
+
+h = hdfmat::hdfmat(f, "x", nr, nc, type, filters="nbit", precision=10)
+h$fill(x)
+stopifnot(max(abs(h$read() - x)) < 2^-9)
+h$close()
+
+unlink(f)
@@ -21,3 +21,30 @@ stopifnot(all.equal(test, truth))
 
 h$close()
 unlink(f)
+
+
+
+# fill() converts between double and float natively, for column-major and
+# "as is" input, and with a row offset
+nr = 40
+nc = 25
+x = matrix(rnorm(nr*nc), nr, nc)
+
+h = hdfmat::hdfmat(f, n, nr, nc, "float")
+h$fill(x[1:10, ])
+h$fill(float::fl(x[11:nr, ]), row_offset=10)
+stopifnot(all.equal(float::dbl(h$read()), float::dbl(float::fl(x))))
+
+# "as is" data is row-major with the dimensions of the block
+y = t(x[1:5, ])
+dim(y) = c(5, nc)
+h$fill(y, asis=TRUE)
+stopifnot(all.equal(float::dbl(h$read(row_stop=5)), float::dbl(float::fl(x[1:5, ]))))
+h$close()
+unlink(f)
+
+h = hdfmat::hdfmat(f, n, nr, nc, "double")
+h$fill(float::fl(x))
+stopifnot(all.equal(h$read(), float::dbl(float::fl(x))))
+h$close()
+unlink(f)
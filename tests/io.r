@@ -19,3 +19,23 @@ stopifnot(all.equal(test, truth))
 
 h$close()
 unlink(f)
+
+
+
+# column-major reads of blocks, through HDF5 (compressed) and through the map
+nr = 70
+nc = 45
+x = matrix(rnorm(nr*nc), nr, nc)
+
+for (compression in c(0L, 4L))
+{
+  h = hdfmat::hdfmat(f, n, nr, nc, type, compression=compression)
+  h$fill(x)
+  
+  stopifnot(all.equal(h$read(), x))
+  stopifnot(all.equal(h$read(row_start=3, row_stop=61, col_start=8, col_stop=44), x[3:61, 8:44]))
+  stopifnot(all.equal(h$read(row_start=9, row_stop=9), x[9, , drop=FALSE]))
+  
+  h$close()
+  unlink(f)
+}
@@ -0,0 +1,35 @@
+library(hdfmat)
+
+f = tempfile()
+g = tempfile()
+type = "double"
+
+nr = 30
+nc = 20
+x = matrix(as.double(1:(nr*nc)), nr, nc)
+b = matrix(as.double(1:(nc*3)), nc, 3)
+bt = matrix(as.double(1:(nr*2)), nr, 2)
+
+h = hdfmat::hdfmat(f, "x", nr, nc, type)
+h$fill(x)
+
+stopifnot(all.equal(h$matmult(b), x %*% b))
+stopifnot(all.equal(h$matmult(bt, trans=TRUE), crossprod(x, bt)))
+
+# force one row per panel
+stopifnot(all.equal(h$matmult(b, mem=1e-6), x %*% b))
+
+# write the product to another dataset
+out = hdfmat::hdfmat(g, "y", nr, 3, type)
+h$matmult(b, mem=1e-6, out=out)
+stopifnot(all.equal(out$read(), x %*% b))
+out$close()
+
+out = hdfmat::hdfmat(g, "y", nc, 2, type)
+h$matmult(bt, trans=TRUE, out=out)
+stopifnot(all.equal(out$read(), crossprod(x, bt)))
+out$close()
+
+h$close()
+unlink(f)
+unlink(g)
@@ -0,0 +1,78 @@
+library(hdfmat)
+
+fx = tempfile()
+fy = tempfile()
+f = tempfile()
+type = "double"
+
+m = 30
+k = 20
+n = 25
+x = matrix(as.double(1:(m*k)), m, k)
+y = matrix(sin(1:(k*n)), k, n)
+
+hx = hdfmat::hdfmat(fx, "x", m, k, type)
+hx$fill(x)
+hy = hdfmat::hdfmat(fy, "y", k, n, type)
+hy$fill(y)
+
+truth = x %*% y
+
+# y resident
+h = matmult_ooc(hx, hy, f)
+stopifnot(all.equal(h$read(), truth))
+
+# tiles of one row of x and a few columns of y
+h$fill_val(0)
+h$fill_matmult(hx, hy, mem=1e-3)
+stopifnot(all.equal(h$read(), truth))
+
+# the result cannot be one of its factors
+fi = tempfile()
+hi = hdfmat::hdfmat(fi, "i", n, n, type)
+hi$fill_identity()
+stopifnot(inherits(try(h$fill_matmult(h, hi), silent=TRUE), "try-error"))
+stopifnot(all.equal(h$read(), truth))
+hi$close()
+unlink(fi)
+h$close()
+
+hx$close()
+hy$close()
+unlink(c(fx, fy, f))
+
+
+
+# a symmetric factor larger than one 256 x 256 tile, on either side: its
+# rows are read through the mirrored tiles
+fs = tempfile()
+ns = 300
+p = 40
+s = crossprod(matrix(sin(1:(20*ns)), 20, ns)) + diag(ns)
+x = matrix(cos(1:(p*ns)), p, ns)
+y = matrix(sin(1:(ns*p)), ns, p)
+
+hs = hdfmat::hdfmat(fs, "s", ns, ns, type, storage="symmetric")
+hs$fill(s)
+hx = hdfmat::hdfmat(fx, "x", p, ns, type)
+hx$fill(x)
+hy = hdfmat::hdfmat(fy, "y", ns, p, type)
+hy$fill(y)
+
+for (mem in c(64, 0.05))
+{
+  h = matmult_ooc(hs, hy, f, mem=mem)
+  stopifnot(all.equal(h$read(), s %*% y))
+  h$close()
+  unlink(f)
+  
+  h = matmult_ooc(hx, hs, f, mem=mem)
+  stopifnot(all.equal(h$read(), x %*% s))
+  h$close()
+  unlink(f)
+}
+
+hs$close()
+hx$close()
+hy$close()
+unlink(c(fs, fx, fy))
@@ -0,0 +1,31 @@
+library(hdfmat)
+
+# float storage with double Lanczos vectors: the same values as the double
+# solver on the float-rounded data
+n = 60
+x = crossprod(matrix(sin(1:(2*n*n)), 2*n, n))
+x_fl = float::dbl(float::fl(x))
+
+f = tempfile()
+g = tempfile()
+h = hdfmat::hdfmat(f, "x", n, n, "float")
+h$fill(x)
+hd = hdfmat::hdfmat(g, "x", n, n, "double")
+hd$fill(x_fl)
+
+test = h$eigen(k=5, seed=1, mixed=TRUE)
+stopifnot(is.double(test))
+stopifnot(all.equal(test, hd$eigen(k=5, seed=1)))
+
+test = h$eigen(k=6, block=2, seed=1, mixed=TRUE)
+stopifnot(all.equal(test, hd$eigen(k=6, block=2, seed=1)))
+
+test = h$svd(k=5, seed=1, mixed=TRUE)
+stopifnot(all.equal(test, hd$svd(k=5, seed=1)))
+
+# float results without it
+stopifnot(float::is.float(h$eigen(k=5, seed=1)))
+
+h$close()
+hd$close()
+unlink(c(f, g))
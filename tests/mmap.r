@@ -0,0 +1,47 @@
+library(hdfmat)
+
+# uncompressed matrices are contiguous and read through a memory map; the
+# results must match the chunked path
+f = tempfile()
+g = tempfile()
+type = "double"
+
+nr = 50
+nc = 20
+x = matrix(sin(1:(nr*nc)), nr, nc)
+
+h = hdfmat::hdfmat(f, "x", nr, nc, type)
+h$fill(x)
+hc = hdfmat::hdfmat(g, "x", nr, nc, type, chunking="tiles")
+hc$fill(x)
+
+stopifnot(all.equal(h$read(), x))
+stopifnot(all.equal(h$read(row_start=5, row_stop=9, col_start=2, col_stop=4), x[5:9, 2:4]))
+stopifnot(all.equal(h$reduce(), hc$reduce()))
+stopifnot(all.equal(h$matmult(diag(nc)), x))
+stopifnot(all.equal(h$svd(k=2, seed=1), hc$svd(k=2, seed=1)))
+
+# writes are seen by later reads
+h$fill(2*x[1:3, ], row_offset=0)
+stopifnot(all.equal(h$read(row_stop=3), 2*x[1:3, ]))
+
+h$close()
+hc$close()
+unlink(f)
+unlink(g)
+
+# a file with a user block: HDF5 finds the superblock after the 512 leading
+# bytes, and the dataset offset it reports already counts them
+h = hdfmat::hdfmat(f, "x", nr, nc, type)
+h$fill(x)
+h$close()
+writeBin(c(raw(512), readBin(f, "raw", file.size(f))), g)
+
+h = hdfmat_open(g, "x")
+h$stats(reset=TRUE)
+stopifnot(all.equal(h$read(), x))
+stopifnot(all.equal(h$matmult(diag(nc)), x))
+stopifnot(.Platform$OS.type == "windows" || h$stats()$maps > 0)
+h$close()
+unlink(f)
+unlink(g)
@@ -0,0 +1,53 @@
+library(hdfmat)
+
+f = tempfile()
+type = "double"
+
+nr = 30
+nc = 20
+x = matrix(sin(1:(nr*nc)), nr, nc)
+
+h = hdfmat::hdfmat(f, "x", nr, nc, type)
+h$fill(x)
+
+r = h$reduce()
+stopifnot(all.equal(r$rowSums, rowSums(x)))
+stopifnot(all.equal(r$colSums, colSums(x)))
+stopifnot(all.equal(r$rowMeans, rowMeans(x)))
+stopifnot(all.equal(r$colMeans, colMeans(x)))
+stopifnot(all.equal(r$rowNorms, sqrt(rowSums(x^2))))
+stopifnot(all.equal(r$colNorms, sqrt(colSums(x^2))))
+stopifnot(all.equal(r$norm, norm(x, "F")))
+stopifnot(all.equal(r$min, min(x)))
+stopifnot(all.equal(r$max, max(x)))
+
+stopifnot(all.equal(h$reduce("colMeans"), colMeans(x)))
+
+# infinite values are reported as such
+h$fill_val(-Inf)
+r = h$reduce(c("min", "max"))
+stopifnot(identical(r$min, -Inf), identical(r$max, -Inf))
+h$fill_val(Inf)
+r = h$reduce(c("min", "max"))
+stopifnot(identical(r$min, Inf), identical(r$max, Inf))
+h$close()
+
+# symmetric storage accounts for the mirrored lower triangle; with more than
+# two 256 x 256 tiles, the off-diagonal tiles must be counted exactly twice
+ns = 600
+s = crossprod(matrix(sin(1:(nr*ns)), nr, ns)) - 1
+h = hdfmat::hdfmat(f, "s", ns, ns, type, storage="symmetric")
+h$fill(s)
+
+r = h$reduce(c("rowSums", "colSums", "rowNorms", "colNorms", "norm", "min", "max", "trace"))
+stopifnot(all.equal(r$rowSums, rowSums(s)))
+stopifnot(all.equal(r$colSums, colSums(s)))
+stopifnot(all.equal(r$rowNorms, sqrt(rowSums(s^2))))
+stopifnot(all.equal(r$colNorms, sqrt(colSums(s^2))))
+stopifnot(all.equal(r$norm, norm(s, "F")))
+stopifnot(all.equal(r$min, min(s)))
+stopifnot(all.equal(r$max, max(s)))
+stopifnot(all.equal(r$trace, sum(diag(s))))
+
+h$close()
+unlink(f)
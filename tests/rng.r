@@ -0,0 +1,39 @@
+library(hdfmat)
+
+f = tempfile()
+g = tempfile()
+type = "double"
+
+nr = 50
+nc = 40
+
+h = hdfmat::hdfmat(f, "x", nr, nc, type)
+k = hdfmat::hdfmat(g, "y", nr, nc, type, chunking="rows")
+
+# same seed, same matrix, whatever the row blocks
+h$fill_runif(seed=1234)
+k$fill_runif(seed=1234)
+x = h$read()
+stopifnot(all.equal(x, k$read()))
+stopifnot(all(x > 0 & x < 1))
+
+h$fill_runif(seed=4321)
+stopifnot(!isTRUE(all.equal(h$read(), x)))
+
+h$fill_rnorm(mean=1, sd=2, seed=1234)
+k$fill_rnorm(mean=1, sd=2, seed=1234)
+x = h$read()
+stopifnot(all.equal(x, k$read()))
+
+# set.seed() drives the default seed
+set.seed(1234)
+h$fill_rnorm()
+x = h$read()
+set.seed(1234)
+h$fill_rnorm()
+stopifnot(all.equal(h$read(), x))
+
+h$close()
+k$close()
+unlink(f)
+unlink(g)
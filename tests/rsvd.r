@@ -0,0 +1,54 @@
+library(hdfmat)
+set.seed(1234)
+
+f = tempfile()
+n = "mydata"
+type = "double"
+
+# the sketch (k+10 = 15 columns) is well below min(nr, nc), and the spectrum
+# decays slowly enough that the power iterations make the difference
+nr = 200
+nc = 150
+k = 5
+d = 10 * 0.8^(0:(nc-1))
+u = qr.Q(qr(matrix(rnorm(nr*nc), nr, nc)))
+v = qr.Q(qr(matrix(rnorm(nc*nc), nc, nc)))
+x = u %*% (d * t(v))
+
+h = hdfmat::hdfmat(f, n, nr, nc, type)
+h$fill(x)
+
+truth = svd(x)$d[1:k]
+relerr = function(test, truth) max(abs(test - truth) / truth)
+
+set.seed(1)
+err2 = relerr(h$svd(k=k, method="randomized", passes=2), truth)
+stopifnot(err2 < 1e-1, err2 > 1e-6)
+
+set.seed(1)
+err6 = relerr(h$svd(k=k, method="randomized", passes=6, mem=0.05), truth)
+stopifnot(err6 < 1e-8)
+
+set.seed(1)
+err3 = relerr(h$svd(k=k, method="randomized", passes=3), truth)
+stopifnot(err3 < err2)
+
+h$close()
+unlink(f)
+
+
+
+f = tempfile()
+cp = crossprod(x)
+h = hdfmat::hdfmat(f, n, nc, nc, type)
+h$fill(cp)
+
+truth = eigen(cp, symmetric=TRUE, only.values=TRUE)$values[1:k]
+set.seed(1)
+err2 = relerr(h$eigen(k=k, method="randomized", passes=2), truth)
+set.seed(1)
+err4 = relerr(h$eigen(k=k, method="randomized", passes=4, mem=0.05), truth)
+stopifnot(err2 > 1e-10, err4 < 1e-8, err4 < err2)
+
+h$close()
+unlink(f)
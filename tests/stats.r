@@ -0,0 +1,62 @@
+library(hdfmat)
+
+f = tempfile()
+type = "double"
+
+nr = 60
+nc = 30
+x = matrix(rnorm(nr*nc), nr, nc)
+
+h = hdfmat::hdfmat(f, "x", nr, nc, type, compression=4L)
+s = h$stats()
+stopifnot(s$calls == 0)
+
+h$fill(x)
+h$read()
+h$reduce()
+s = h$stats(reset=TRUE)
+stopifnot(s$calls == 3)
+stopifnot(s$writes > 0)
+stopifnot(s$reads > 0)
+stopifnot(s$bytes_written == nr*nc*8)
+stopifnot(s$bytes_read >= 2*nr*nc*8)
+stopifnot(all(s$time >= 0))
+
+s = h$stats()
+stopifnot(s$calls == 0 && s$reads == 0)
+
+h$cache(1)
+h$read(row_stop=5)
+h$read(row_stop=5)
+stopifnot(h$stats()$cache[["hits"]] > 0)
+
+h$close()
+unlink(f)
+
+# contiguous datasets are read through a memory map where possible
+g = tempfile()
+h = hdfmat::hdfmat(g, "x", nr, nc, type)
+h$fill(x)
+h$stats(reset=TRUE)
+h$reduce()
+s = h$stats()
+stopifnot(s$bytes_read + s$bytes_mapped >= nr*nc*8)
+stopifnot(s$maps == 0 || s$bytes_mapped == nr*nc*8)
+h$close()
+unlink(g)
+
+# counters do not outlive their matrix: matrices opened after others are
+# closed (and their native objects freed) start from zero
+for (i in 1:5)
+{
+  h = hdfmat::hdfmat(g, "x", nr, nc, type)
+  h$fill(x)
+  h$close()
+  invisible(gc())
+  
+  h = hdfmat::hdfmat_open(g, "x")
+  stopifnot(h$stats()$calls == 0)
+  h$close()
+  invisible(gc())
+  unlink(g)
+}
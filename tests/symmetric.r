@@ -0,0 +1,57 @@
+library(hdfmat)
+
+f = tempfile()
+n = "mydata"
+type = "double"
+
+# n > 2 tiles of 256 and not a multiple of one, so reads cross tile
+# boundaries, mirror off-diagonal tiles, and end in partial tiles
+nr = 3
+nc = 600
+x = matrix(sin(1:(nr*nc)), nr, nc)
+storage.mode(x) = type
+
+h = crossprod_ooc(x, f, name=n, storage="symmetric")
+truth = crossprod(x)
+stopifnot(all.equal(h$read(), truth))
+stopifnot(all.equal(h$read(2, 5, 1, 3), truth[2:5, 1:3]))
+stopifnot(all.equal(h$read(250, 520, 3, 590), truth[250:520, 3:590]))
+stopifnot(all.equal(h$read(513, 600, 1, 300), truth[513:600, 1:300]))
+stopifnot(all.equal(h$read(1, 600, 257, 257), truth[, 257, drop=FALSE]))
+
+set.seed(1234)
+test = h$eigen(k=3)
+stopifnot(all.equal(test, eigen(truth)$values[1:3], 1e-6))
+
+h$scale(2)
+stopifnot(all.equal(h$read(), 2*truth))
+h$close()
+
+h = hdfmat_open(f, n)
+stopifnot(all.equal(h$read(), 2*truth))
+h$close()
+
+unlink(f)
+
+# filled directly, in blocks of rows that do not line up with the tiles
+h = hdfmat::hdfmat(f, n, nc, nc, type, storage="symmetric")
+h$fill(truth[1:300, ])
+h$fill(truth[301:600, ], row_offset=300)
+stopifnot(all.equal(h$read(), truth))
+h$close()
+
+unlink(f)
+
+# values written below the diagonal are ignored, also inside diagonal tiles
+a = matrix(cos(1:(nc*nc)), nc, nc)
+u = a
+u[lower.tri(u)] = t(a)[lower.tri(a)]
+y = matrix(sin(1:(2*nc)), nc, 2)
+h = hdfmat::hdfmat(f, n, nc, nc, type, storage="symmetric")
+h$fill(a)
+stopifnot(all.equal(h$read(), u))
+stopifnot(all.equal(h$matmult(y), u %*% y))
+stopifnot(all.equal(h$matmult(y, mem=0.01), u %*% y))
+h$close()
+
+unlink(f)
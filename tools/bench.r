@@ -0,0 +1,375 @@
+#!/usr/bin/env Rscript
+# Benchmarks of the hdfmat kernels over a grid of shapes, types, compression
+# levels, and chunk layouts. Each timing is appended as a row of a CSV file,
+# so runs on different versions, machines, or file systems can be compared:
+#
+#   Rscript tools/bench.r --dir=/dev/shm --out=tmpfs.csv --label=0.3-0
+#   Rscript tools/bench.r --dir=/scratch --out=disk.csv --label=0.3-0
+#   Rscript tools/bench.r --compare=old.csv,new.csv
+#
+# Running the same grid on tmpfs and on a real disk separates the cost of the
+# I/O from that of decompression and compute. The input of the read-only
+# kernels has just been written, so unless --cold is given (and works) their
+# reads come from the page cache; the cache column says which. Options:
+#   --dir      directory for the HDF5 files (default: tempdir())
+#   --out      CSV file the results are appended to (default: bench.csv); an
+#              existing file must have the same columns
+#   --label    free-form label stored with every row, e.g. a version
+#   --size     scale of the matrix dimensions (default: 1)
+#   --reps     repetitions per kernel; the median time is kept (default: 3)
+#   --kernels  comma-separated subset of the kernels below
+#   --compare  two CSV files: prints the time ratio of matching rows
+#   --threshold  slowdown ratio reported as a regression (default: 1.1)
+#   --cold     1 to drop the page cache before each timed run (Linux, as
+#              root); rows where that fails are still labeled warm
+#
+# Columns: the configuration, the median wall time in seconds, MB/s of data
+# moved through HDF5 (or memory maps), counting the writes of the result of
+# crossprod_ooc and tcrossprod_ooc, GFLOP/s where the flop count is known
+# (counting a multiply-add as 2 flops, as for GEMM),
+# passes over the input, the I/O and blocked times from stats(), and the peak
+# RSS in MiB (Linux only; the high-water mark is reset before each kernel if
+# the kernel allows it).
+
+suppressMessages(library(hdfmat))
+
+KERNELS = c("fill", "read", "scale", "fill_val", "fill_runif", "fill_rnorm",
+  "fill_linspace", "fill_diag", "fill_identity", "reduce", "matmult",
+  "crossprod_ooc", "tcrossprod_ooc", "eigen", "svd")
+
+KEYS = c("label", "fs", "cache", "kernel", "nrows", "ncols", "type", "compression", "chunking")
+COLUMNS = c(KEYS, "seconds", "MB_s", "GFLOP_s", "passes", "io_seconds", "blocked_seconds", "peak_rss_MiB")
+
+
+
+# ------------------------------------------------------------------------------
+# options
+# ------------------------------------------------------------------------------
+
+get_opts = function(args)
+{
+  opts = list(dir=tempdir(), out="bench.csv", label="", size=1, reps=3,
+    kernels=paste(KERNELS, collapse=","), compare="", threshold=1.1, cold=0)
+  
+  for (a in args)
+  {
+    kv = regmatches(a, regexec("^--([a-z]+)=(.*)$", a))[[1]]
+    if (length(kv) != 3 || !(kv[2] %in% names(opts)))
+      stop(paste("unknown option:", a))
+    
+    opts[[kv[2]]] = kv[3]
+  }
+  
+  opts$size = as.double(opts$size)
+  opts$reps = as.integer(opts$reps)
+  opts$threshold = as.double(opts$threshold)
+  opts$cold = isTRUE(as.integer(opts$cold) == 1L)
+  opts$kernels = strsplit(opts$kernels, ",")[[1]]
+  if (!all(opts$kernels %in% KERNELS))
+    stop(paste("unknown kernel:", paste(setdiff(opts$kernels, KERNELS), collapse=", ")))
+  
+  opts
+}
+
+
+
+# ------------------------------------------------------------------------------
+# measurements
+# ------------------------------------------------------------------------------
+
+fs_type = function(dir)
+{
+  ret = tryCatch(system2("stat", c("-f", "-c", "%T", shQuote(dir)), stdout=TRUE, stderr=FALSE),
+    error=function(e) character(0), warning=function(w) character(0))
+  
+  if (length(ret) == 0)
+    "unknown"
+  else
+    ret[1]
+}
+
+# writing 5 to clear_refs resets VmHWM (Linux >= 4.0)
+reset_peak_rss = function()
+{
+  if (file.exists("/proc/self/clear_refs"))
+    try(cat("5", file="/proc/self/clear_refs"), silent=TRUE)
+  
+  invisible()
+}
+
+peak_rss = function()
+{
+  if (!file.exists("/proc/self/status"))
+    return(NA_real_)
+  
+  status = readLines("/proc/self/status")
+  hwm = grep("^VmHWM:", status, value=TRUE)
+  if (length(hwm) == 0)
+    return(NA_real_)
+  
+  as.double(gsub("[^0-9]", "", hwm)) / 1024
+}
+
+# writing 1 to drop_caches frees the clean page cache (Linux, as root)
+drop_page_cache = function()
+{
+  f = "/proc/sys/vm/drop_caches"
+  if (!file.exists(f))
+    return(FALSE)
+  
+  system2("sync")
+  tryCatch({cat("1", file=f); TRUE}, error=function(e) FALSE, warning=function(w) FALSE)
+}
+
+# Run setup() then fun() reps times and return the median time along with the
+# stats() of the matrix h returned by setup() for the last run, and whether
+# every run started with a cold page cache.
+time_kernel = function(setup, fun, reps, cold)
+{
+  times = numeric(reps)
+  dropped = cold
+  for (r in seq_len(reps))
+  {
+    h = setup()
+    h$stats(reset=TRUE)
+    gc(verbose=FALSE)
+    if (cold)
+      dropped = drop_page_cache() && dropped
+    reset_peak_rss()
+    
+    times[r] = system.time(fun(h))[["elapsed"]]
+    s = h$stats()
+    rss = peak_rss()
+    h$close()
+  }
+  
+  list(seconds=stats::median(times), stats=s, rss=rss, cache=if (dropped) "cold" else "warm")
+}
+
+
+
+# ------------------------------------------------------------------------------
+# kernels
+# ------------------------------------------------------------------------------
+
+# flops of a kernel on an m x n matrix, or NA if not known in advance; the
+# crossproducts of full storage are formed by GEMM, so like the products they
+# count 2 flops per multiply-add
+flops = function(kernel, m, n, k)
+{
+  switch(kernel,
+    matmult = 2*m*n*k,
+    crossprod_ooc = 2*m*n*n,
+    tcrossprod_ooc = 2*m*m*n,
+    NA_real_
+  )
+}
+
+bench_config = function(opts, m, n, type, compression, chunking)
+{
+  f = file.path(opts$dir, "hdfmat_bench.h5")
+  g = file.path(opts$dir, "hdfmat_bench_out.h5")
+  on.exit(unlink(c(f, g)))
+  
+  size = if (type == "double") 8 else 4
+  x = matrix(stats::rnorm(m*n), m, n)
+  
+  new = function()
+    hdfmat::hdfmat(f, "x", m, n, type, compression=compression, chunking=chunking)
+  
+  # a stored matrix to be read by the read-only kernels
+  filled = function()
+  {
+    h = new()
+    h$fill_rnorm(seed=1)
+    h$close()
+    hdfmat::hdfmat_open(f, "x")
+  }
+  
+  k = 3
+  y = matrix(stats::rnorm(n*k), n, k)
+  
+  # bytes written to a result hdfmat other than the timed one, by the last run
+  written = 0
+  out_close = function(out)
+  {
+    written <<- out$stats()$bytes_written
+    out$close()
+  }
+  
+  kernels = list(
+    fill = list(new, function(h) h$fill(x)),
+    read = list(filled, function(h) h$read()),
+    scale = list(filled, function(h) h$scale(2)),
+    fill_val = list(new, function(h) h$fill_val(1)),
+    fill_runif = list(new, function(h) h$fill_runif(seed=1)),
+    fill_rnorm = list(new, function(h) h$fill_rnorm(seed=1)),
+    fill_linspace = list(new, function(h) h$fill_linspace(0, 1)),
+    fill_diag = list(filled, function(h) h$fill_diag(1)),
+    fill_identity = list(new, function(h) h$fill_identity()),
+    reduce = list(filled, function(h) h$reduce()),
+    matmult = list(filled, function(h) h$matmult(y)),
+    crossprod_ooc = list(filled, function(h) {
+      out_close(hdfmat::crossprod_ooc(h, g, compression=compression))
+    }),
+    tcrossprod_ooc = list(filled, function(h) {
+      out_close(hdfmat::tcrossprod_ooc(h, g, compression=compression))
+    }),
+    eigen = list(function() {
+      h = filled()
+      out = hdfmat::crossprod_ooc(h, g, compression=compression)
+      h$close()
+      out
+    }, function(h) h$eigen(k=k, seed=1)),
+    svd = list(filled, function(h) h$svd(k=k, seed=1))
+  )
+  
+  rows = NULL
+  for (kernel in opts$kernels)
+  {
+    # the crossproducts of wide matrices are too large to be worth timing
+    if (kernel %in% c("crossprod_ooc", "eigen") && n > 4*m)
+      next
+    if (kernel == "tcrossprod_ooc" && m > 4*n)
+      next
+    
+    written = 0
+    res = tryCatch(time_kernel(kernels[[kernel]][[1]], kernels[[kernel]][[2]], opts$reps, opts$cold),
+      error=function(e) {message("  ", kernel, ": ", conditionMessage(e)); NULL})
+    if (is.null(res))
+      next
+    
+    s = res$stats
+    bytes_in = s$bytes_read + s$bytes_mapped
+    bytes = bytes_in + s$bytes_written + written
+    
+    in_bytes = m*n*size
+    if (kernel == "eigen")
+      in_bytes = n*n*size
+    
+    row = data.frame(
+      label = opts$label,
+      fs = opts$fs,
+      cache = res$cache,
+      kernel = kernel,
+      nrows = m,
+      ncols = n,
+      type = type,
+      compression = compression,
+      chunking = chunking,
+      seconds = res$seconds,
+      MB_s = bytes / 1e6 / res$seconds,
+      GFLOP_s = flops(kernel, m, n, k) / 1e9 / res$seconds,
+      passes = bytes_in / in_bytes,
+      io_seconds = s$time[["io"]],
+      blocked_seconds = s$time[["blocked"]],
+      peak_rss_MiB = res$rss,
+      stringsAsFactors = FALSE
+    )
+    
+    message(sprintf("  %-15s %8.3fs %9.1f MB/s", kernel, row$seconds, row$MB_s))
+    rows = rbind(rows, row)
+  }
+  
+  rows
+}
+
+# rows are appended without a header, so an existing file must have exactly
+# these columns or they would land under the wrong ones
+check_out = function(out)
+{
+  if (!file.exists(out))
+    return(invisible())
+  
+  header = names(utils::read.csv(out, nrows=1, check.names=FALSE))
+  if (!identical(header, COLUMNS))
+    stop(paste0("'", out, "' has different columns; use a new --out file"))
+  
+  invisible()
+}
+
+bench = function(opts)
+{
+  s = opts$size
+  shapes = list(
+    tall = round(s*c(20000, 500)),
+    square = round(s*c(3000, 3000)),
+    wide = round(s*c(500, 20000))
+  )
+  
+  opts$fs = fs_type(opts$dir)
+  check_out(opts$out)
+  
+  for (shape in shapes)
+  {
+    for (type in c("double", "float"))
+    {
+      for (compression in c(0L, 4L))
+      {
+        chunkings = if (compression == 0L) c("contiguous", "rows", "tiles") else c("rows", "tiles")
+        for (chunking in chunkings)
+        {
+          message(sprintf("%d x %d %s compression=%d chunking=%s", shape[1], shape[2], type, compression, chunking))
+          rows = bench_config(opts, shape[1], shape[2], type, compression, chunking)
+          if (is.null(rows))
+            next
+          
+          append = file.exists(opts$out)
+          utils::write.table(rows[COLUMNS], opts$out, sep=",", row.names=FALSE, col.names=!append, append=append)
+        }
+      }
+    }
+  }
+  
+  invisible()
+}
+
+
+
+# ------------------------------------------------------------------------------
+# comparison
+# ------------------------------------------------------------------------------
+
+compare = function(opts)
+{
+  files = strsplit(opts$compare, ",")[[1]]
+  if (length(files) != 2)
+    stop("--compare needs two files")
+  
+  keys = setdiff(KEYS, "label")
+  old = utils::read.csv(files[1], stringsAsFactors=FALSE)
+  new = utils::read.csv(files[2], stringsAsFactors=FALSE)
+  
+  # files from before the cache column were all warm
+  if (is.null(old$cache))
+    old$cache = "warm"
+  if (is.null(new$cache))
+    new$cache = "warm"
+  
+  # the last result of each configuration counts
+  old = old[!duplicated(old[keys], fromLast=TRUE), ]
+  new = new[!duplicated(new[keys], fromLast=TRUE), ]
+  
+  both = merge(old[c(keys, "seconds")], new[c(keys, "seconds")], by=keys, suffixes=c("_old", "_new"))
+  both$ratio = both$seconds_new / both$seconds_old
+  both = both[order(-both$ratio), ]
+  
+  print(both, row.names=FALSE, digits=3)
+  
+  slow = both[both$ratio > opts$threshold, ]
+  if (nrow(slow) > 0)
+  {
+    cat(sprintf("\n%d of %d configurations are more than %.0f%% slower\n", nrow(slow), nrow(both), 100*(opts$threshold - 1)))
+    quit(status=1)
+  }
+  
+  invisible()
+}
+
+
+
+opts = get_opts(commandArgs(trailingOnly=TRUE))
+if (nzchar(opts$compare))
+  compare(opts)
+else
+  bench(opts)